@@ -12,6 +12,29 @@ simcache.cpp
 #include <iomanip>
 #include <regex>
 #include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <list>
+#include <deque>
+#include <set>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "simlog.h"
 
 using namespace std;
 
@@ -20,38 +43,100 @@ size_t const static NUM_REGS = 8;
 size_t const static MEM_SIZE = 1 << 13;
 size_t const static REG_SIZE = 1 << 16;
 
+// Build with -DSIMCACHE_NO_STATS to compile the --stats instrumentation out
+#ifdef SIMCACHE_NO_STATS
+bool const static STATS_COMPILED = false;
+#else
+bool const static STATS_COMPILED = true;
+#endif
+
 /*
-    Loads an E20 machine code file into the list
-    provided by mem. We assume that mem is
-    large enough to hold the values in the machine
-    code file.
+    The simulator's own counters and timers, reported by --stats. Times
+    are in nanoseconds; execution time is whatever part of the run was not
+    spent in cache lookups or printing the log.
+*/
+struct SimStats {
+    bool enabled = false;
+    uint64_t instructions = 0;
+    uint64_t load_ns = 0;     // loading the program, checkpoint or trace header
+    uint64_t run_ns = 0;      // executing the program or replaying the trace
+    uint64_t lookup_ns = 0;   // cache_access()
+    uint64_t output_ns = 0;   // print_log_entry()
+    uint64_t total_ns = 0;
+};
+
+thread_local SimStats stats; // per thread, so --batch workers never share the timers; theirs stay disabled
 
-    @param f Open file to read from
+/*
+    Returns the current time in nanoseconds when --stats is on, or 0
+    otherwise, so that timing a section costs only a branch without it.
+*/
+uint64_t stats_clock() {
+    if (!STATS_COMPILED || !stats.enabled)
+        return 0;
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+    The architectural state of an E20 machine.
+*/
+struct Machine {
+    unsigned PC = 0;
+    unsigned registers[NUM_REGS] = {};
+    unsigned memory[MEM_SIZE] = {};
+};
+
+/*
+    Parses E20 machine code into the list provided by mem,
+    reporting problems instead of exiting.
+
+    @param f Open stream to read from
     @param mem Array represetnting memory into which to read program
+    @param error Set to a description of the problem on failure
+
+    @return false if the machine code could not be loaded
 */
-void load_machine_code(ifstream& f, unsigned mem[]) {
+bool parse_machine_code(istream& f, unsigned mem[], string& error) {
     regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
     size_t expectedaddr = 0;
     string line;
     while (getline(f, line)) {
         smatch sm;
         if (!regex_match(line, sm, machine_code_re)) {
-            cerr << "Can't parse line: " << line << endl;
-            exit(1);
+            error = "Can't parse line: " + line;
+            return false;
         }
         size_t addr = stoi(sm[1], nullptr, 10);
         unsigned instr = stoi(sm[2], nullptr, 2);
         if (addr != expectedaddr) {
-            cerr << "Memory addresses encountered out of sequence: " << addr << endl;
-            exit(1);
+            error = "Memory addresses encountered out of sequence: " + to_string(addr);
+            return false;
         }
         if (addr >= MEM_SIZE) {
-            cerr << "Program too big for memory" << endl;
-            exit(1);
+            error = "Program too big for memory";
+            return false;
         }
         expectedaddr++;
         mem[addr] = instr;
     }
+    return true;
+}
+
+/*
+    Loads an E20 machine code file into the list
+    provided by mem. We assume that mem is
+    large enough to hold the values in the machine
+    code file.
+
+    @param f Open file to read from
+    @param mem Array represetnting memory into which to read program
+*/
+void load_machine_code(ifstream& f, unsigned mem[]) {
+    string error;
+    if (!parse_machine_code(f, mem, error)) {
+        cerr << error << endl;
+        exit(1);
+    }
 }
 
 /*
@@ -113,6 +198,225 @@ bool check_if_halt(unsigned opCode, unsigned PC) {
 
     return is_halt;
 }
+
+
+// The kinds of instruction that change the pc other than to the next instruction
+enum BranchKind { BRANCH_NONE, BRANCH_JEQ, BRANCH_J, BRANCH_JAL, BRANCH_JR };
+const char* const BRANCH_KIND_NAMES[] = { "", "jeq", "j", "jal", "jr" };
+
+/*
+    Describes what an executed instruction did that the simulator
+    models care about.
+*/
+struct ExecInfo {
+    unsigned pc = 0;        // address the instruction was fetched from
+    bool is_load = false;   // the instruction was a lw
+    bool is_store = false;  // the instruction was a sw
+    int addr = 0;           // the data address of a lw or sw, as it appears in the log
+    BranchKind branch = BRANCH_NONE;
+    bool taken = false;     // a jeq went to its target
+    int offset = 0;         // the rel_imm of a jeq
+    unsigned next_pc = 0;   // the pc after the instruction
+    unsigned reads = 0;     // bit r is set if the instruction read register r
+    unsigned dst = 0;       // the register the instruction wrote, 0 if none
+};
+
+
+/*
+    Executes the instruction at the current PC of the machine, without
+    simulating the caches.
+
+    @param m The machine to advance by one instruction
+
+    @param info Filled in with the memory access made by the instruction
+
+    @return false if the instruction is a halt, in which case it is not executed
+*/
+bool execute_instruction(Machine& m, ExecInfo& info) {
+    unsigned& PC = m.PC;
+    unsigned* registers = m.registers;
+    unsigned* memory = m.memory;
+
+    if (check_if_halt(memory[PC], PC)) {
+        return false;
+    }
+
+    unsigned regSrc = 0;
+    unsigned regDst = 0;
+    unsigned imm = 0;
+    unsigned regA = 0;
+    unsigned regB = 0;
+    int rel_imm = 0;
+    unsigned regAddr = 0;
+
+    info = ExecInfo();
+    info.pc = PC;
+
+    if (bits_extracter(memory[PC], 3, 13) == 1) { // its an addi/movi
+        // since its addi, lets extract regSrc, regDst, and imm
+
+        regSrc = bits_extracter(memory[PC], 3, 10);  // extracting which register is in regSrc position of addi
+        regDst = bits_extracter(memory[PC], 3, 7);   // extracting which register is in regDst position of addi 
+        imm = bits_extracter(memory[PC], 7, 0);      // extracting immediate value
+
+
+        if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
+            imm = (((~imm) & 127) + 1) * -1;  // converts value to negative
+        }
+
+        if (regDst != 0) { // we can never allow the program to update register 0
+            registers[regDst] = (registers[regSrc] + imm) & (REG_SIZE - 1);  // "& (REG_SIZE - 1)" ensures we stay in 16 bit size range
+        }
+        info.reads = 1 << regSrc;
+        info.dst = regDst;
+
+        // increment PC
+        PC = (PC + 1) & (MEM_SIZE - 1);   // doing & (MEM_SIZE-1) ensures it stays in 13 bit range
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 7) { // its an slti
+        regSrc = bits_extracter(memory[PC], 3, 10);
+        regDst = bits_extracter(memory[PC], 3, 7);
+        imm = bits_extracter(memory[PC], 7, 0);
+
+        if (regDst != 0) {
+            if ((registers[regSrc] & (REG_SIZE - 1)) < (imm & (REG_SIZE - 1))) { // we need to have the imm be 16 bits (same bits as the reg val) 
+                registers[regDst] = 1;
+            }
+            else {
+                registers[regDst] = 0;
+            }
+        }
+        info.reads = 1 << regSrc;
+        info.dst = regDst;
+
+        PC = (PC + 1) & (MEM_SIZE - 1);
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 6) { // its an jeq
+        regA = bits_extracter(memory[PC], 3, 10);
+        regB = bits_extracter(memory[PC], 3, 7);
+        rel_imm = bits_extracter(memory[PC], 7, 0); // extracts rel_imm
+
+        if (bits_extracter(rel_imm, 1, 6) == 1) { // jeq also has signed rel_imm so we need to convert to negative if msb is 1
+            rel_imm = (((~rel_imm) & 127) + 1) * -1;
+        }
+
+        info.branch = BRANCH_JEQ;
+        info.offset = rel_imm;
+        info.reads = (1 << regA) | (1 << regB);
+        if (registers[regA] == registers[regB]) {
+            PC = (PC + 1 + rel_imm) & (MEM_SIZE - 1);  // when we jump too we need to make sure program counter stays in range
+            info.taken = true;
+        }
+        else {
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 0) { // it's a 3 reg arg instruction (add,sub,and..)
+        regA = bits_extracter(memory[PC], 3, 10);
+        regB = bits_extracter(memory[PC], 3, 7);
+        regDst = bits_extracter(memory[PC], 3, 4);
+        info.reads = (1 << regA) | (1 << regB);
+        info.dst = regDst;
+        if (bits_extracter(memory[PC], 4, 0) == 0) { // it's an add
+            if (regDst != 0) {
+                registers[regDst] = (registers[regA] + registers[regB]) & (REG_SIZE - 1);
+                // & (REG_SIZE - 1) ensures the number stays in the 16 bit range
+            }
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        else if (bits_extracter(memory[PC], 4, 0) == 1) { // it's a sub
+            if (regDst != 0) {
+                registers[regDst] = (registers[regA] - registers[regB]) & (REG_SIZE - 1);
+            }
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        else if (bits_extracter(memory[PC], 4, 0) == 2) { // its an and
+            if (regDst != 0) {
+                registers[regDst] = (registers[regA] & registers[regB]) & (REG_SIZE - 1);
+            }
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        else if (bits_extracter(memory[PC], 4, 0) == 3) { // its an or
+            if (regDst != 0) {
+                registers[regDst] = (registers[regA] | registers[regB]) & (REG_SIZE - 1);
+            }
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        else if (bits_extracter(memory[PC], 4, 0) == 4) { // its a slt
+            if (regDst != 0) {
+                if (((registers[regA]) & (REG_SIZE - 1)) < (registers[regB] & (REG_SIZE - 1))) { // if a negative number is inside a register, interpret it as unsigned in 16 bit range
+                    registers[regDst] = 1;
+                }
+                else {
+                    registers[regDst] = 0;
+                }
+            }
+            PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        else if (bits_extracter(memory[PC], 4, 0) == 8) { // its a jr
+            regSrc = bits_extracter(memory[PC], 3, 10);
+            PC = (registers[regSrc]) & (MEM_SIZE - 1); // for the case where a val inside a register is more than 13 bits, ignore 3 most signif bits
+            info.branch = BRANCH_JR;
+            info.reads = 1 << regSrc;
+            info.dst = 0;
+        }
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 4) { // its a LW
+        regAddr = bits_extracter(memory[PC], 3, 10);
+        regDst = bits_extracter(memory[PC], 3, 7);
+        imm = bits_extracter(memory[PC], 7, 0);
+
+        if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
+            imm = (((~imm) & 127) + 1) * -1;
+        }
+
+        if (regDst != 0) {
+            registers[regDst] = (memory[(registers[regAddr] + imm) & (MEM_SIZE - 1)]) & (REG_SIZE - 1);
+            // makes sure sum of regAddr and imm val stays in range of memory size
+        }
+
+        info.is_load = true;
+        info.addr = registers[regAddr] + imm;
+        info.reads = 1 << regAddr;
+        info.dst = regDst;
+
+        PC = (PC + 1) & (MEM_SIZE - 1);
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 5) { // its an SW
+        regAddr = bits_extracter(memory[PC], 3, 10);
+        regSrc = bits_extracter(memory[PC], 3, 7);
+        imm = bits_extracter(memory[PC], 7, 0);
+
+        if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
+            imm = (((~imm) & 127) + 1) * -1;
+        }
+
+        memory[(registers[regAddr] + imm) & (MEM_SIZE - 1)] = registers[regSrc]; // memory pointer must be in 13 bit range
+
+        info.is_store = true;
+        info.addr = registers[regAddr] + imm;
+        info.reads = (1 << regAddr) | (1 << regSrc);
+
+        PC = (PC + 1) & (MEM_SIZE - 1);
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 2) { // its a j
+        PC = (bits_extracter(memory[PC], 13, 0)) & (MEM_SIZE - 1);
+        info.branch = BRANCH_J;
+    }
+    else if (bits_extracter(memory[PC], 3, 13) == 3) { // its a jal
+        imm = bits_extracter(memory[PC], 13, 0);
+
+        registers[7] = PC + 1;
+
+        PC = imm & (MEM_SIZE - 1);
+        info.branch = BRANCH_JAL;
+        info.dst = 7;
+    }
+
+    info.next_pc = PC;
+    return true;
+}
 // ^^^^^SIM.CPP FUNCTIONS^^^^^^^
 /*
     Prints out the correctly-formatted configuration of a cache.
@@ -132,6 +436,134 @@ void print_cache_config(const string& cache_name, int size, int assoc, int block
         ", lines " << num_lines << endl;
 }
 
+/*
+    The binary event log of --event-log, see simlog.h for the format.
+    Events are buffered a column at a time until a chunk is full.
+*/
+struct EventLog {
+    ofstream f;
+    vector<string> names;          // the caches, in the order of the header
+    vector<string> notes;          // the notes, "" first
+    const uint64_t* clock = nullptr; // the pipeline cycle, null without --pipeline
+    vector<uint64_t> cycle;
+    vector<uint32_t> line;
+    vector<uint32_t> addr;
+    vector<uint16_t> pc;
+    vector<uint8_t> level;
+    vector<uint8_t> status;
+    vector<uint8_t> note;
+};
+
+// Set while --event-log takes the log entries instead of the standard output
+thread_local EventLog* event_log = nullptr;
+
+
+// Appends the low bytes of v to out, least significant first
+void put_le(string& out, uint64_t v, int bytes) {
+    for (int byte = 0; byte < bytes; byte++)
+        out += char((v >> (8 * byte)) & 0xff);
+}
+
+
+/*
+    Creates an event log and writes its header.
+
+    @param configs The size, associativity, blocksize and lines of every
+        cache in names, four values each
+
+    @param notes Every note an entry may carry besides the empty one
+*/
+void open_event_log(EventLog& log, const string& filename, const vector<string>& names,
+    const vector<int>& configs, const vector<string>& notes) {
+    log.f.open(filename, ios::binary);
+    if (!log.f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        exit(1);
+    }
+    log.names = names;
+    log.notes = { "" };
+    log.notes.insert(log.notes.end(), notes.begin(), notes.end());
+    string header(EVENT_LOG_MAGIC, 8);
+    put_le(header, EVENT_LOG_VERSION, 4);
+    put_le(header, names.size(), 4);
+    for (size_t i = 0; i < names.size(); i++) {
+        put_le(header, names[i].size(), 1);
+        header += names[i];
+        for (int j = 0; j < 4; j++)
+            put_le(header, configs[4 * i + j], 4);
+    }
+    put_le(header, log.notes.size(), 4);
+    for (const string& n : log.notes) {
+        put_le(header, n.size(), 1);
+        header += n;
+    }
+    header.resize((header.size() + 7) / 8 * 8, '\0');
+    log.f.write(header.data(), header.size());
+}
+
+
+void flush_event_chunk(EventLog& log) {
+    size_t n = log.cycle.size();
+    if (n == 0)
+        return;
+    string chunk;
+    chunk.reserve(event_chunk_bytes(n));
+    put_le(chunk, n, 4);
+    put_le(chunk, 0, 4);
+    for (uint64_t v : log.cycle)
+        put_le(chunk, v, 8);
+    for (uint32_t v : log.line)
+        put_le(chunk, v, 4);
+    for (uint32_t v : log.addr)
+        put_le(chunk, v, 4);
+    for (uint16_t v : log.pc)
+        put_le(chunk, v, 2);
+    chunk.append(log.level.begin(), log.level.end());
+    chunk.append(log.status.begin(), log.status.end());
+    chunk.append(log.note.begin(), log.note.end());
+    chunk.resize(event_chunk_bytes(n), '\0');
+    log.f.write(chunk.data(), chunk.size());
+    log.cycle.clear();
+    log.line.clear();
+    log.addr.clear();
+    log.pc.clear();
+    log.level.clear();
+    log.status.clear();
+    log.note.clear();
+}
+
+
+/*
+    Adds an entry to the event log, taking the arguments of print_log_entry().
+*/
+void log_event(EventLog& log, const string& cache_name, const string& status, int pc, int addr, int line,
+    const string& note) {
+    size_t level = find(log.names.begin(), log.names.end(), cache_name) - log.names.begin();
+    size_t kind = find(EVENT_STATUS_NAMES, EVENT_STATUS_NAMES + EVENT_STATUSES, status) - EVENT_STATUS_NAMES;
+    size_t n = find(log.notes.begin(), log.notes.end(), note) - log.notes.begin();
+    // an entry the header can't describe would be read back as another one, so refuse it
+    if (level == log.names.size() || kind == EVENT_STATUSES || n == log.notes.size()) {
+        cerr << "Can't write log entry " << cache_name << " " << status << " " << note << " to the event log" << endl;
+        exit(1);
+    }
+    log.cycle.push_back(log.clock != nullptr ? *log.clock : 0);
+    log.line.push_back(line);
+    log.addr.push_back(addr);
+    log.pc.push_back(pc);
+    log.level.push_back(level);
+    log.status.push_back(kind);
+    log.note.push_back(n);
+    if (log.cycle.size() >= EVENT_LOG_CHUNK)
+        flush_event_chunk(log);
+}
+
+
+void close_event_log(EventLog& log) {
+    flush_event_chunk(log);
+    log.f.close();
+}
+
+
 /*
     Prints out a correctly-formatted log entry.
 
@@ -148,961 +580,4078 @@ void print_cache_config(const string& cache_name, int size, int assoc, int block
 
     @param line The cache line or set number where the data
         is stored.
+
+    @param note Extra detail appended to the entry, such as the
+        kind of miss. Nothing is appended when empty
+
+    With --event-log the entry goes to the event log instead.
 */
-void print_log_entry(const string& cache_name, const string& status, int pc, int addr, int line) {
+void print_log_entry(const string& cache_name, const string& status, int pc, int addr, int line, const string& note = "") {
+    if (event_log != nullptr) {
+        log_event(*event_log, cache_name, status, pc, addr, line, note);
+        return;
+    }
     cout << left << setw(8) << cache_name + " " + status << right <<
         " pc:" << setw(5) << pc <<
         "\taddr:" << setw(5) << addr <<
-        "\tline:" << setw(4) << line << endl;
+        "\tline:" << setw(4) << line;
+    if (!note.empty())
+        cout << "\t" << note;
+    cout << '\n'; // not endl: flushing every entry dominates the run time once fetches are logged
 }
 
 
 /*
-    Updates the bookkeeping vector by appending the just accessed value to the end of the vector and deleting that value from the vector if it already exists
-    Call would usually be: update_bookkeeping(bookkeeping1 or 2[L1line or L2line], (L1blockID / L1numlines));
+    Sorts the misses of one cache into compulsory, capacity and conflict
+    misses. It remembers every block the cache has seen, and shadows the
+    cache with a fully associative LRU cache of the same size, kept as a
+    recency list with a hash index so each access costs O(1).
+*/
+struct MissClassifier {
+    bool enabled = false;
+    size_t capacity = 0;                              // blocks in the cache, or in its sampled lines
+    unordered_set<int> seen;                          // every block ever accessed
+    list<int> recency;                                // the shadow cache's blocks, most recent first
+    unordered_map<int, list<int>::iterator> shadow;   // where each block is in recency
+    uint64_t compulsory = 0;
+    uint64_t capacity_misses = 0;
+    uint64_t conflict = 0;
+};
+
+
+// The three kinds of miss, and how they are named in the log
+enum MissClass { MISS_COMPULSORY, MISS_CAPACITY, MISS_CONFLICT };
+const char* const MISS_CLASS_NAMES[] = { "compulsory", "capacity", "conflict" };
+
+/*
+    Runs an access through the shadow structures of a miss classifier.
 
-    @param bookkeeping_vec The bookkeeping vector itself.
+    @param blockID The block being accessed
 
-    @param tag The just accessed tag.
-    
+    @return MISS_COMPULSORY if the block was never accessed before,
+        MISS_CAPACITY if the fully associative shadow cache misses too
+        and MISS_CONFLICT otherwise
 */
-void update_bookkeeping(vector<int>& bookkeeping_vec, int tag) {
-    if (find(bookkeeping_vec.begin(), bookkeeping_vec.end(), tag) != bookkeeping_vec.end()) { // if the number about to be pushed back is already in bookkeeping
-        bookkeeping_vec.erase(find(bookkeeping_vec.begin(), bookkeeping_vec.end(), tag)); // erase first occurrence of the duplicate
-        bookkeeping_vec.push_back(tag); // then append it 
+MissClass classify_access(MissClassifier& mc, int blockID) {
+    bool first_touch = mc.seen.insert(blockID).second;
+    bool shadow_hit = false;
+    unordered_map<int, list<int>::iterator>::iterator found = mc.shadow.find(blockID);
+    if (found != mc.shadow.end()) {
+        shadow_hit = true;
+        mc.recency.splice(mc.recency.begin(), mc.recency, found->second);
     }
-    else { // if the number about to be pushed back is not in bookkeeping already
-        bookkeeping_vec.push_back(tag); // append it
+    else {
+        mc.recency.push_front(blockID);
+        mc.shadow[blockID] = mc.recency.begin();
+        if (mc.recency.size() > mc.capacity) {
+            mc.shadow.erase(mc.recency.back());
+            mc.recency.pop_back();
+        }
     }
+    if (first_touch)
+        return MISS_COMPULSORY;
+    return shadow_hit ? MISS_CONFLICT : MISS_CAPACITY;
 }
 
 
-/**
-    Main function
-    Takes command-line args as documented below
+/*
+    A CAT-style partition of a cache. The accesses of its requestor, the
+    instructions in a range of pcs or the accesses to a range of data
+    addresses, may only fill the ways in its mask, though they hit in any
+    way. Accesses that belong to no partition may fill any way, and an
+    access in the range of several partitions belongs to the first.
 */
-int main(int argc, char* argv[]) {
-    /*
-        Parse the command-line arguments
-    */
-    char* filename = nullptr;
-    bool do_help = false;
-    bool arg_error = false;
-    string cache_config;
-    for (int i = 1; i < argc; i++) {
-        string arg(argv[i]);
-        if (arg.rfind("-", 0) == 0) {
-            if (arg == "-h" || arg == "--help")
-                do_help = true;
-            else if (arg == "--cache") {
-                i++;
-                if (i >= argc)
-                    arg_error = true;
-                else
-                    cache_config = argv[i];
-            }
-            else
-                arg_error = true;
+struct Partition {
+    bool by_pc = true;      // the requestor is a range of pcs, or else of data addresses
+    int lo = 0;             // the range, inclusive
+    int hi = 0;
+    unsigned mask = 0;      // bit w allows way w
+    uint64_t hits = 0;      // lw hits
+    uint64_t misses = 0;    // lw misses
+    uint64_t stores = 0;
+};
+
+
+// Lines of a cache are given storage in pages of this many line slots
+int const static LINES_PER_PAGE = 1024;
+
+/*
+    The state of one level of the cache hierarchy. Direct mapped
+    caches are simply caches whose lines hold a single tag.
+
+    A line takes no storage until it is first accessed. It is then given
+    the next slot of the arena, which holds for each slot the tags of its
+    ways (-1 marks an empty way), the same tags in the order they were
+    accessed, least recent first, and how many tags the line holds. The
+    slot of each line is found through pages of slot numbers that are
+    also only allocated once one of their lines is touched. A negative
+    address maps to a negative line, so the pages cover the lines from
+    -numlines up.
+*/
+struct Cache {
+    string name;
+    int size = 0;
+    int assoc = 0;
+    int blocksize = 0;
+    int numlines = 0;
+    vector<vector<int>> pages;        // the arena slot of each line from -numlines up, -1 if the line is untouched
+    vector<int> arena;                // 2 * assoc + 1 ints per touched line, see above
+    vector<int> slot_line;            // the line each slot belongs to
+    uint64_t hits = 0;                // lw hits, or fetch hits of an instruction cache
+    uint64_t misses = 0;              // lw misses, or fetch misses of an instruction cache
+    uint64_t stores = 0;              // sw accesses
+    uint64_t fetch_hits = 0;          // instruction fetches that missed I1 and hit this unified level
+    uint64_t fetch_misses = 0;        // instruction fetches that missed I1 and this unified level
+    int sample_ratio = 1;             // only lines picked by line_sampled() are simulated, see --set-sample
+    int sampled_lines = 0;
+    vector<uint64_t> slot_hits;       // lw hits of each touched line, kept only when set sampling
+    vector<uint64_t> slot_misses;     // lw misses of each touched line, kept only when set sampling
+    MissClassifier classes;           // 3C classification of lw misses, see --3c
+    vector<Partition> partitions;     // see --partition
+    vector<int> way_owner;            // the partition that filled each way of each slot, -1 for none.
+                                      // Kept only when partitioned
+    int sector_size = 0;              // words per sector, 0 if the cache is not sectored, see --sector
+    vector<uint32_t> sector_valid;    // bit s is set if sector s of the block in a way is present, like way_owner
+    vector<uint32_t> sector_dirty;    // bit s is set if sector s was written since it was fetched
+    uint64_t sector_misses = 0;       // accesses whose tag was present but sector was not
+    uint64_t fill_words = 0;          // words fetched into a sectored cache
+    uint64_t writeback_words = 0;     // dirty words a sectored cache wrote back on eviction
+};
+
+
+/*
+    Returns the arena slot of a line, or -1 if the line was never touched.
+*/
+int line_slot(const Cache& c, int line) {
+    int index = line + c.numlines;
+    const vector<int>& page = c.pages[index / LINES_PER_PAGE];
+    return page.empty() ? -1 : page[index % LINES_PER_PAGE];
+}
+
+
+/*
+    Returns the state of a line in the arena, giving the line a slot if
+    this is the first time it is touched. The pointer is only good until
+    the next line is given a slot.
+*/
+int* touch_line(Cache& c, int line) {
+    int stride = 2 * c.assoc + 1;
+    int index = line + c.numlines;
+    vector<int>& page = c.pages[index / LINES_PER_PAGE];
+    if (page.empty())
+        page.assign(LINES_PER_PAGE, -1);
+    int& slot = page[index % LINES_PER_PAGE];
+    if (slot < 0) {
+        slot = c.slot_line.size();
+        c.slot_line.push_back(line);
+        c.arena.resize(c.arena.size() + stride, -1);
+        c.arena[(slot + 1) * stride - 1] = 0;
+        if (c.sample_ratio > 1) {
+            c.slot_hits.push_back(0);
+            c.slot_misses.push_back(0);
         }
-        else {
-            if (filename == nullptr)
-                filename = argv[i];
-            else
-                arg_error = true;
+        if (!c.partitions.empty())
+            c.way_owner.resize(c.way_owner.size() + c.assoc, -1);
+        if (c.sector_size > 0) {
+            c.sector_valid.resize(c.sector_valid.size() + c.assoc, 0);
+            c.sector_dirty.resize(c.sector_dirty.size() + c.assoc, 0);
         }
     }
-    /* Display error message if appropriate */
-    if (arg_error || do_help || filename == nullptr) {
-        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] filename" << endl << endl;
-        cerr << "Simulate E20 cache" << endl << endl;
-        cerr << "positional arguments:" << endl;
-        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl << endl;
-        cerr << "optional arguments:" << endl;
-        cerr << "  -h, --help  show this help message and exit" << endl;
-        cerr << "  --cache CACHE  Cache configuration: size,associativity,blocksize (for one" << endl;
-        cerr << "                 cache) or" << endl;
-        cerr << "                 size,associativity,blocksize,size,associativity,blocksize" << endl;
-        cerr << "                 (for two caches)" << endl;
-        return 1;
-    }
+    return &c.arena[slot * stride];
+}
 
-    int L1size;
-    int L1assoc;
-    int L1blocksize;
-    int L1numlines;
-    int L2size;
-    int L2assoc;
-    int L2blocksize;
-    int L2numlines;
-    bool two_caches = false;
-    // moved these^ outside of starter code so it can be accessed later
 
-    if (cache_config.size() > 0) {
-        vector<int> parts;
-        size_t pos;
-        size_t lastpos = 0;
-        while ((pos = cache_config.find(",", lastpos)) != string::npos) {
-            parts.push_back(stoi(cache_config.substr(lastpos, pos)));
-            lastpos = pos + 1;
-        }
-        parts.push_back(stoi(cache_config.substr(lastpos)));
-        if (parts.size() == 3) { // that means only one cache (L1)
-            L1size = parts[0];
-            L1assoc = parts[1];
-            L1blocksize = parts[2];
+/*
+    Decides whether a line of a set-sampled cache is simulated. Lines are
+    picked by a hash of the line number so that the sample is spread
+    evenly over the cache instead of favouring low or strided lines.
+*/
+bool line_sampled(const Cache& c, int line) {
+    if (c.sample_ratio <= 1)
+        return true;
+    unsigned h = line;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h % c.sample_ratio == 0;
+}
 
 
-            // DO: calculate L1numlines and print cache configuration
-            L1numlines = L1size / (L1assoc * L1blocksize);
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, L1numlines);
-        }
-        else if (parts.size() == 6) {
-            two_caches = true;
-            L1size = parts[0];
-            L1assoc = parts[1];
-            L1blocksize = parts[2];
-            L2size = parts[3];
-            L2assoc = parts[4];
-            L2blocksize = parts[5];
-            // TODO: execute E20 program and simulate two caches here
+/*
+    Sets up an empty cache. No line takes storage until it is accessed.
 
+    @param c The cache to initialize
 
-            
-            if (L1assoc < 2) { // if associativity is 1. This means it's direct mapped
-                L1numlines = L1size / L1blocksize;
-            }
-            else { // if associativity is greater than 1, but the associativity * blocksize is equal to the cache size, then it's fully associative
-                L1numlines = L1size / (L1assoc * L1blocksize);
-            }
+    @param name The name of the cache. "L1" or "L2"
 
-            if (L2assoc < 2) { // if associativity is 1. This means it's direct mapped
-                L2numlines = L2size / L2blocksize;
-            }
-            else { // if associativity is greater than 1, but the associativity * blocksize is equal to the cache size, then it's fully associative
-                L2numlines = L2size / (L2assoc * L2blocksize);
-            }
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, L1numlines);
-            print_cache_config("L2", L2size, L2assoc, L2blocksize, L2numlines);
+    @param size The total size of the cache, measured in memory cells
 
+    @param assoc The associativity of the cache
 
-        }
-        else {
-            cerr << "Invalid cache config" << endl;
-            return 1;
+    @param blocksize The blocksize of the cache
+
+    @param sample_ratio Simulate only about one in sample_ratio lines
+*/
+void init_cache(Cache& c, const string& name, int size, int assoc, int blocksize, int sample_ratio = 1) {
+    c.name = name;
+    c.size = size;
+    c.assoc = assoc;
+    c.blocksize = blocksize;
+    c.numlines = size / (assoc * blocksize);
+    c.pages.assign((2 * c.numlines + LINES_PER_PAGE - 1) / LINES_PER_PAGE, vector<int>());
+    c.sample_ratio = sample_ratio;
+    c.sampled_lines = c.numlines;
+    if (sample_ratio > 1) {
+        c.sampled_lines = 0;
+        for (int line = 0; line < c.numlines; line++)
+            if (line_sampled(c, line))
+                c.sampled_lines++;
+        if (c.sampled_lines == 0) { // a tiny cache may hash no lines into the sample, simulate all of it
+            c.sample_ratio = 1;
+            c.sampled_lines = c.numlines;
         }
     }
+}
 
-    vector<int> a1_L1cache;  // L1cache with assoc of 1
-    vector<vector<int>> a_n_L1cache; // L1cache with assoc of n
 
-    vector<int> a1_L2cache;  // L2cache with assoc of 1
-    vector<vector<int>> a_n_L2cache; // L2cache with assoc of 1
-    // cache creation
-    if (two_caches == false) { // only L1 cache
-        if (L1assoc == 1) {
-            a1_L1cache.resize(L1numlines, -1); // since this is direct mapped (assoc is 1) we dont need vec of a vec of ints, there will only be 1 tag for each line
-        }
-        else {
-            vector<int> inner_vec(L1assoc, -1);
-            a_n_L1cache.resize(L1numlines, inner_vec);               // each inner vector depends on the associativity, the outer vector depends on the number of lines
-        }
-    }
-    else { // both L1 and L2 caches
-        // Must create two caches
-        if (L1assoc == 1) {
-            a1_L1cache.resize(L1numlines, -1); // since this is direct mapped (assoc is 1) we dont need vec of a vec of ints, there will only be 1 tag for each line
-        }
-        else {
-            vector<int> inner_vec(L1assoc, -1);
-            a_n_L1cache.resize(L1numlines, inner_vec);               // each inner vector depends on the associativity, the outer vector depends on the number of lines
-        }
+/*
+    Parses a command-line value that must be a whole integer.
 
+    @param min The smallest value allowed
 
-        if (L2assoc == 1) {
-            a1_L2cache.resize(L2numlines, -1);
-        }
-        else {
-            vector<int> inner_vec(L2assoc, -1);
-            a_n_L2cache.resize(L2numlines, inner_vec);
-        }
+    @param value Set to the integer, only if it is valid
+
+    @return false if text is not an integer of at least min
+*/
+bool parse_int_arg(const string& text, int min, int& value) {
+    size_t used = 0;
+    int parsed;
+    try {
+        parsed = stoi(text, &used);
+    } catch (const exception&) {
+        return false;
     }
-    
-    vector<vector<int>> bookkeeping(L1numlines); // this vector keeps track of the order each of the tags for each line was accessed FOR L1cache
-    vector<vector<int>> bookkeeping2(L2numlines); // same thing but for L2cache
-    
-    int LRU_int;  // this will refer to the first val of each line, so bookkeeping[L1line][0]
-    vector<int>::iterator LRU_iter;  // the iter for the location of that element in the vector
+    if (used != text.size() || parsed < min)
+        return false;
+    value = parsed;
+    return true;
+}
 
-    int LRU_int2;   // bookkeeping2[L2line][0]
-    vector<int>::iterator LRU_iter2;  // it's iter for location in the vector
 
-    // sim.cpp main comes here
-    ifstream f(filename);
-    if (!f.is_open()) {
-        cerr << "Can't open file " << filename << endl;
-        return 1;
-    }
+/*
+    Parses a command-line count that must be a whole non-negative integer
+    of up to 64 bits.
 
-    unsigned* memory = new unsigned[MEM_SIZE];
-    unsigned* registers = new unsigned[NUM_REGS];
-    // initialize all registers to 0
-    for (size_t reg = 0; reg < NUM_REGS; reg++) {
-        registers[reg] = 0;
+    @param value Set to the count, only if it is valid
+
+    @return false if text is not such an integer
+*/
+bool parse_count_arg(const string& text, uint64_t& value) {
+    size_t used = 0;
+    uint64_t parsed;
+    if (text.empty() || !isdigit((unsigned char)text[0])) // stoull would take a sign and wrap a negative count
+        return false;
+    try {
+        parsed = stoull(text, &used);
+    } catch (const exception&) {
+        return false;
     }
+    if (used != text.size())
+        return false;
+    value = parsed;
+    return true;
+}
 
-    load_machine_code(f, memory);
 
+// The largest cache size accepted, in memory cells. Far beyond the E20's
+// memory, and small enough that the line pages of a cache stay cheap
+int const static MAX_CACHE_SIZE = 1 << 20;
 
-    unsigned PC = 0;
-    unsigned regSrc = 0;
-    unsigned regDst = 0;
-    unsigned imm = 0;
-    unsigned regA = 0;
-    unsigned regB = 0;
-    int rel_imm = 0;
-    unsigned regAddr = 0;
+/*
+    Sets up the caches described by a --cache configuration string.
 
+    @param config size,associativity,blocksize for one cache, or six values for two.
+        Sizes above MAX_CACHE_SIZE are invalid
 
+    @param caches Set to the empty caches
 
+    @param sample_ratio The --set-sample ratio of the last cache level
 
+    @return false if the configuration is invalid
+*/
+bool parse_cache_config(const string& config, vector<Cache>& caches, int sample_ratio) {
+    vector<int> parts;
+    size_t pos;
+    size_t lastpos = 0;
+    while ((pos = config.find(",", lastpos)) != string::npos) {
+        parts.push_back(0);
+        if (!parse_int_arg(config.substr(lastpos, pos - lastpos), 1, parts.back()))
+            return false;
+        lastpos = pos + 1;
+    }
+    parts.push_back(0);
+    if (!parse_int_arg(config.substr(lastpos), 1, parts.back()))
+        return false;
+    if (parts.size() != 3 && parts.size() != 6)
+        return false;
+    for (size_t i = 0; i < parts.size(); i += 3) {
+        // assoc * blocksize is compared by division, the product of two ints can overflow
+        if (parts[i] < 1 || parts[i + 1] < 1 || parts[i + 2] < 1 || parts[i] > MAX_CACHE_SIZE ||
+            parts[i + 1] > parts[i] / parts[i + 2])
+            return false;
+    }
+    caches.resize(parts.size() / 3);
+    for (size_t level = 0; level < caches.size(); level++) {
+        init_cache(caches[level], level == 0 ? "L1" : "L2", parts[3 * level], parts[3 * level + 1], parts[3 * level + 2],
+            level + 1 == caches.size() ? sample_ratio : 1);
+    }
+    return true;
+}
+
+
+/*
+    Returns the line (set) of a cache that an address maps to.
+*/
+int cache_line_of(const Cache& c, int addr) {
+    return (addr / c.blocksize) % c.numlines;
+}
 
 
-    while (check_if_halt(memory[PC], PC) == false) {
-        if (bits_extracter(memory[PC], 3, 13) == 1) { // its an addi/movi
-            // since its addi, lets extract regSrc, regDst, and imm
+/*
+    Returns the partition of a cache that an access belongs to, or -1 if
+    it belongs to none.
+*/
+int find_partition(const Cache& c, int pc, int addr) {
+    for (size_t i = 0; i < c.partitions.size(); i++) {
+        const Partition& part = c.partitions[i];
+        int key = part.by_pc ? pc : addr;
+        if (key >= part.lo && key <= part.hi)
+            return i;
+    }
+    return -1;
+}
 
-            regSrc = bits_extracter(memory[PC], 3, 10);  // extracting which register is in regSrc position of addi
-            regDst = bits_extracter(memory[PC], 3, 7);   // extracting which register is in regDst position of addi 
-            imm = bits_extracter(memory[PC], 7, 0);      // extracting immediate value
 
+/*
+    Looks up an address in a cache, bringing its block in on a miss and
+    evicting the least recently used tag of the line if it is full. In a
+    sectored cache only the sector of the address is brought in, and a
+    tag that is present without that sector is a miss too.
 
-            if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
-                imm = (((~imm) & 127) + 1) * -1;  // converts value to negative
-            }
+    @param c The cache to access
 
-            if (regDst != 0) { // we can never allow the program to update register 0
-                registers[regDst] = (registers[regSrc] + imm) & (REG_SIZE - 1);  // "& (REG_SIZE - 1)" ensures we stay in 16 bit size range
+    @param addr The memory address being accessed
+
+    @param line Set to the line the address maps to
+
+    @param partition The partition of the access, -1 if it may fill any way
+
+    @param write Whether the access is a sw, which makes its sector dirty
+
+    @return true on a hit, false on a miss
+*/
+bool cache_access(Cache& c, int addr, int& line, int partition = -1, bool write = false) {
+    int blockID = addr / c.blocksize;
+    line = blockID % c.numlines;
+    int tag = blockID / c.numlines;
+    int* ways = touch_line(c, line);
+    int* order = ways + c.assoc;
+    int& used = order[c.assoc];
+    size_t first = 0; // the index of the line's first way in way_owner and the sector bits
+    if (c.sector_size > 0 || !c.partitions.empty())
+        first = (ways - c.arena.data()) / (2 * c.assoc + 1) * c.assoc;
+    // the word of the block, which % leaves negative for a negative address
+    int offset = (addr % c.blocksize + c.blocksize) % c.blocksize;
+    uint32_t sector = c.sector_size > 0 ? 1u << (offset / c.sector_size) : 0;
+
+    for (int i = 0; i < used; i++) {
+        if (order[i] == tag) { // the tag is already in the cache, it's a HIT
+            rotate(order + i, order + i + 1, order + used); // it is now the most recently used
+            if (c.sector_size == 0)
+                return true;
+            size_t way = first + (find(ways, ways + c.assoc, tag) - ways);
+            bool present = c.sector_valid[way] & sector;
+            if (!present) { // but the sector is not, fetch it
+                c.sector_valid[way] |= sector;
+                c.sector_misses++;
+                c.fill_words += c.sector_size;
             }
+            if (write)
+                c.sector_dirty[way] |= sector;
+            return present;
+        }
+    }
 
-            // increment PC
-            PC = (PC + 1) & (MEM_SIZE - 1);   // doing & (MEM_SIZE-1) ensures it stays in 13 bit range
+    int way;
+    if (partition >= 0) { // only the ways of the partition may be filled
+        unsigned mask = c.partitions[partition].mask;
+        way = 0;
+        while (way < c.assoc && (ways[way] != -1 || !(mask >> way & 1)))
+            way++;
+        if (way < c.assoc) { // an allowed way is empty
+            order[used++] = tag;
         }
-        else if (bits_extracter(memory[PC], 3, 13) == 7) { // its an slti
-            regSrc = bits_extracter(memory[PC], 3, 10);
-            regDst = bits_extracter(memory[PC], 3, 7);
-            imm = bits_extracter(memory[PC], 7, 0);
+        else { // evict the least recently used tag of the allowed ways
+            int i = 0;
+            while (!(mask >> (way = find(ways, ways + c.assoc, order[i]) - ways) & 1))
+                i++;
+            rotate(order + i, order + i + 1, order + used);
+            order[used - 1] = tag;
+        }
+    }
+    else if (used < c.assoc) { // there is an empty way, put the tag there
+        way = find(ways, ways + c.assoc, -1) - ways;
+        order[used++] = tag;
+    }
+    else { // the line is full so the LRU tag is evicted
+        way = find(ways, ways + c.assoc, order[0]) - ways;
+        rotate(order, order + 1, order + used);
+        order[used - 1] = tag;
+    }
+    if (!c.partitions.empty())
+        c.way_owner[first + way] = partition;
+    if (c.sector_size > 0) {
+        if (ways[way] != -1) // the evicted block writes back its dirty sectors
+            c.writeback_words += uint64_t(__builtin_popcount(c.sector_dirty[first + way])) * c.sector_size;
+        c.sector_valid[first + way] = sector;
+        c.sector_dirty[first + way] = write ? sector : 0;
+        c.fill_words += c.sector_size;
+    }
+    ways[way] = tag;
+    return false;
+}
 
-            if (regDst != 0) {
-                if ((registers[regSrc] & (REG_SIZE - 1)) < (imm & (REG_SIZE - 1))) { // we need to have the imm be 16 bits (same bits as the reg val) 
-                    registers[regDst] = 1;
-                }
-                else {
-                    registers[regDst] = 0;
-                }
-            }
 
+/*
+    Simulates a lw or sw against the cache hierarchy. A lw goes to the
+    next level only when it misses; a sw is write-allocate and goes to
+    the next level when it misses L1.
 
+    @param caches The cache levels, L1 first. May be empty
 
-            PC = (PC + 1) & (MEM_SIZE - 1);
-        }
-        else if (bits_extracter(memory[PC], 3, 13) == 6) { // its an jeq
-            //unsigned imm = 0;
-            regA = bits_extracter(memory[PC], 3, 10);
-            regB = bits_extracter(memory[PC], 3, 7);
-            rel_imm = bits_extracter(memory[PC], 7, 0); // extracts rel_imm
+    @param is_store Whether the access is a sw
 
-            //cout << "msb is  " << bits_extracter(rel_imm, 1, 6) << endl;
-            if (bits_extracter(rel_imm, 1, 6) == 1) { // jeq also has signed rel_imm so we need to convert to negative if msb is 1
-                rel_imm = (((~rel_imm) & 127) + 1) * -1;
-            }
+    @param pc The program counter of the memory access instruction
 
-            if (registers[regA] == registers[regB]) {
-                PC = (PC + 1 + rel_imm) & (MEM_SIZE - 1);  // when we jump too we need to make sure program counter stays in range
-            }
-            else {
-                PC = (PC + 1) & (MEM_SIZE - 1);
-            }
+    @param addr The memory address being accessed
+
+    @param log Whether to print a log entry for each level accessed
 
+    @return The level that held the block, caches.size() if it came from memory
+*/
+int simulate_access(vector<Cache>& caches, bool is_store, int pc, int addr, bool log) {
+    for (size_t level = 0; level < caches.size(); level++) {
+        Cache& c = caches[level];
+        if (c.sample_ratio > 1 && !line_sampled(c, cache_line_of(c, addr)))
+            return level; // set sampling: the access maps to a line that is not simulated
+        int line;
+        uint64_t t = stats_clock();
+        int partition = c.partitions.empty() ? -1 : find_partition(c, pc, addr);
+        bool hit = cache_access(c, addr, line, partition, is_store);
+        stats.lookup_ns += stats_clock() - t;
+        if (partition >= 0) {
+            Partition& part = c.partitions[partition];
+            is_store ? part.stores++ : hit ? part.hits++ : part.misses++;
         }
-        else if (bits_extracter(memory[PC], 3, 13) == 0) { // it's a 3 reg arg instruction (add,sub,and..)
-            regA = bits_extracter(memory[PC], 3, 10);
-            regB = bits_extracter(memory[PC], 3, 7);
-            regDst = bits_extracter(memory[PC], 3, 4);
-            if (bits_extracter(memory[PC], 4, 0) == 0) { // it's an add
-                if (regDst != 0) {
-                    registers[regDst] = (registers[regA] + registers[regB]) & (REG_SIZE - 1);
-                    // & (REG_SIZE - 1) ensures the number stays in the 16 bit range
-                }
-                PC = (PC + 1) & (MEM_SIZE - 1);
-            }
-            else if (bits_extracter(memory[PC], 4, 0) == 1) { // it's a sub
-                if (regDst != 0) {
-                    registers[regDst] = (registers[regA] - registers[regB]) & (REG_SIZE - 1);
-                }
-                PC = (PC + 1) & (MEM_SIZE - 1);
+        const char* miss_class = "";
+        if (c.classes.enabled) {
+            MissClass kind = classify_access(c.classes, addr / c.blocksize);
+            if (!hit && !is_store) {
+                miss_class = MISS_CLASS_NAMES[kind];
+                if (kind == MISS_COMPULSORY)
+                    c.classes.compulsory++;
+                else if (kind == MISS_CAPACITY)
+                    c.classes.capacity_misses++;
+                else
+                    c.classes.conflict++;
             }
-            else if (bits_extracter(memory[PC], 4, 0) == 2) { // its an and
-                if (regDst != 0) {
-                    registers[regDst] = (registers[regA] & registers[regB]) & (REG_SIZE - 1);
-                }
-                PC = (PC + 1) & (MEM_SIZE - 1);
+        }
+        if (c.sample_ratio > 1 && !is_store) {
+            if (hit)
+                c.slot_hits[line_slot(c, line)]++;
+            else
+                c.slot_misses[line_slot(c, line)]++;
+        }
+        t = stats_clock();
+        if (is_store) {
+            c.stores++;
+            if (log)
+                print_log_entry(c.name, "SW", pc, addr, line);
+        }
+        else if (hit) {
+            c.hits++;
+            if (log)
+                print_log_entry(c.name, "HIT", pc, addr, line);
+        }
+        else {
+            c.misses++;
+            if (log)
+                print_log_entry(c.name, "MISS", pc, addr, line, miss_class);
+        }
+        stats.output_ns += stats_clock() - t;
+        if (hit) {
+            // a sw that hits a direct mapped L1 is still written through to the next level's log,
+            // without changing that level's contents
+            if (is_store && c.assoc == 1 && level + 1 < caches.size()) {
+                Cache& next = caches[level + 1];
+                if (next.sample_ratio > 1 && !line_sampled(next, cache_line_of(next, addr)))
+                    return level;
+                next.stores++;
+                int next_partition = next.partitions.empty() ? -1 : find_partition(next, pc, addr);
+                if (next_partition >= 0)
+                    next.partitions[next_partition].stores++;
+                t = stats_clock();
+                if (log)
+                    print_log_entry(next.name, "SW", pc, addr, cache_line_of(next, addr));
+                stats.output_ns += stats_clock() - t;
             }
-            else if (bits_extracter(memory[PC], 4, 0) == 3) { // its an or
-                if (regDst != 0) {
-                    registers[regDst] = (registers[regA] | registers[regB]) & (REG_SIZE - 1);
-                }
-                PC = (PC + 1) & (MEM_SIZE - 1);
+            return level;
+        }
+    }
+    return caches.size();
+}
+
+
+// The jeq direction predictors --branch can model, and how they are named
+enum PredictorKind { PREDICT_STATIC, PREDICT_BIMODAL, PREDICT_GSHARE, PREDICT_TAGE };
+const char* const PREDICTOR_NAMES[] = { "static", "bimodal", "gshare", "tage" };
+
+// The tagged tables of the TAGE-lite predictor and the global history length each is indexed with
+int const static TAGE_TABLES = 4;
+int const static TAGE_HISTORY[TAGE_TABLES] = { 4, 8, 16, 32 };
+int const static TAGE_TAG_BITS = 8;
+
+/*
+    One entry of a tagged TAGE table.
+*/
+struct TageEntry {
+    int tag = -1;       // -1 if the entry was never allocated
+    int ctr = 0;        // -4 to 3, predicts taken when not negative
+    int useful = 0;     // 0 to 3, only entries that are not useful are replaced
+};
+
+/*
+    Predicts the control flow of the program. The direction of a jeq comes
+    from the chosen direction predictor; its target is known once it is
+    decoded. The targets of j and jal come from a direct mapped branch
+    target buffer, and those of jr from a return address stack that jal
+    pushes, or from the buffer when the stack is empty. An instruction is
+    mispredicted when the pc fetched after it would have been wrong.
+*/
+struct BranchPredictor {
+    bool enabled = false;
+    PredictorKind kind = PREDICT_BIMODAL;
+    int bits = 12;                      // log2 of the entries of the counter table
+    int penalty = 2;                    // cycles lost on every mispredict
+    vector<uint8_t> counters;           // 2-bit counters of bimodal and gshare, and the base predictor of TAGE
+    vector<vector<TageEntry>> tage;     // the tagged tables of TAGE, shortest history first
+    uint64_t history = 0;               // outcomes of the latest jeqs, the latest in bit 0
+    vector<int> btb_pc;                 // the pc each BTB entry belongs to, -1 if empty
+    vector<unsigned> btb_target;
+    size_t ras_depth = 8;
+    vector<unsigned> ras;               // return addresses, the latest last
+    vector<uint8_t> pc_kind;            // the BranchKind of each pc, once executed
+    vector<uint64_t> pc_executed;
+    vector<uint64_t> pc_mispredicts;
+    uint64_t kind_executed[5] = {};
+    uint64_t kind_mispredicts[5] = {};
+};
+
+
+/*
+    Sets up a cold branch predictor.
+
+    @param kind The jeq direction predictor
+
+    @param bits log2 of the entries of its counter table
+
+    @param btb_entries The entries of the branch target buffer
+
+    @param ras_depth The entries of the return address stack
+*/
+void init_branch_predictor(BranchPredictor& bp, PredictorKind kind, int bits, int btb_entries, int ras_depth) {
+    bp.enabled = true;
+    bp.kind = kind;
+    bp.bits = bits;
+    bp.counters.assign(size_t(1) << bits, 2); // weakly taken
+    bp.tage.clear();
+    if (kind == PREDICT_TAGE)
+        bp.tage.assign(TAGE_TABLES, vector<TageEntry>(size_t(1) << max(1, bits - 2)));
+    bp.history = 0;
+    bp.btb_pc.assign(btb_entries, -1);
+    bp.btb_target.assign(btb_entries, 0);
+    bp.ras_depth = ras_depth;
+    bp.ras.clear();
+    bp.pc_kind.assign(MEM_SIZE, BRANCH_NONE);
+    bp.pc_executed.assign(MEM_SIZE, 0);
+    bp.pc_mispredicts.assign(MEM_SIZE, 0);
+}
+
+
+/*
+    Sets up the branch predictor described by a --branch configuration.
+
+    @param config KIND[,BITS[,BTB_ENTRIES[,RAS_DEPTH]]]
+
+    @return false if the configuration is invalid
+*/
+bool parse_branch_config(const string& config, BranchPredictor& bp) {
+    size_t comma = config.find(",");
+    string name = config.substr(0, comma);
+    vector<int> parts = { 12, 64, 8 };
+    size_t lastpos = comma + 1;
+    for (size_t part = 0; comma != string::npos; part++) {
+        comma = config.find(",", lastpos);
+        if (part == parts.size())
+            return false;
+        string value = config.substr(lastpos, comma - lastpos);
+        size_t used = 0;
+        try {
+            parts[part] = stoi(value, &used);
+        } catch (const exception&) {
+            return false;
+        }
+        if (used != value.size())
+            return false;
+        lastpos = comma + 1;
+    }
+    if (parts[0] < 1 || parts[0] > 24 || parts[1] < 1 || parts[2] < 1)
+        return false;
+    for (int kind = PREDICT_STATIC; kind <= PREDICT_TAGE; kind++) {
+        if (name == PREDICTOR_NAMES[kind]) {
+            init_branch_predictor(bp, PredictorKind(kind), parts[0], parts[1], parts[2]);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*
+    Folds the latest length bits of a history into bits bits by xoring
+    them together.
+*/
+unsigned fold_history(uint64_t history, int length, int bits) {
+    if (length < 64)
+        history &= (uint64_t(1) << length) - 1;
+    unsigned folded = 0;
+    for (int done = 0; done < length; done += bits)
+        folded ^= unsigned(history >> done);
+    return folded & ((1u << bits) - 1);
+}
+
+
+/*
+    Predicts the direction of a jeq and trains the predictor with what it
+    actually did.
+
+    @return The predicted direction, true for taken
+*/
+bool predict_jeq(BranchPredictor& bp, const ExecInfo& info) {
+    unsigned mask = (1u << bp.bits) - 1;
+    bool predicted;
+    if (bp.kind == PREDICT_STATIC) {
+        predicted = info.offset < 0; // backward taken, forward not taken
+    }
+    else if (bp.kind == PREDICT_BIMODAL || bp.kind == PREDICT_GSHARE) {
+        unsigned index = (bp.kind == PREDICT_GSHARE ? info.pc ^ unsigned(bp.history) : info.pc) & mask;
+        uint8_t& counter = bp.counters[index];
+        predicted = counter >= 2;
+        if (info.taken && counter < 3)
+            counter++;
+        else if (!info.taken && counter > 0)
+            counter--;
+    }
+    else {
+        int table_bits = max(1, bp.bits - 2);
+        unsigned index[TAGE_TABLES];
+        int tag[TAGE_TABLES];
+        int provider = -1;
+        int alternate = -1;
+        for (int i = TAGE_TABLES - 1; i >= 0; i--) {
+            index[i] = (info.pc ^ fold_history(bp.history, TAGE_HISTORY[i], table_bits)) & ((1u << table_bits) - 1);
+            tag[i] = (info.pc ^ (fold_history(bp.history, TAGE_HISTORY[i], TAGE_TAG_BITS - 1) << 1)) &
+                ((1 << TAGE_TAG_BITS) - 1);
+            if (bp.tage[i][index[i]].tag == tag[i]) {
+                if (provider < 0)
+                    provider = i;
+                else if (alternate < 0)
+                    alternate = i;
             }
-            else if (bits_extracter(memory[PC], 4, 0) == 4) { // its a slt
-                if (regDst != 0) {
-                    if (((registers[regA]) & (REG_SIZE - 1)) < (registers[regB] & (REG_SIZE - 1))) { // if a negative number is inside a register, interpret it as unsigned in 16 bit range
-                        registers[regDst] = 1;
-                    }
-                    else {
-                        registers[regDst] = 0;
-                    }
+        }
+        uint8_t& base = bp.counters[info.pc & mask];
+        bool alternate_prediction = alternate >= 0 ? bp.tage[alternate][index[alternate]].ctr >= 0 : base >= 2;
+        if (provider >= 0) {
+            TageEntry& e = bp.tage[provider][index[provider]];
+            predicted = e.ctr >= 0;
+            if (predicted != alternate_prediction)
+                e.useful = predicted == info.taken ? min(3, e.useful + 1) : max(0, e.useful - 1);
+            e.ctr = info.taken ? min(3, e.ctr + 1) : max(-4, e.ctr - 1);
+        }
+        else {
+            predicted = base >= 2;
+            if (info.taken && base < 3)
+                base++;
+            else if (!info.taken && base > 0)
+                base--;
+        }
+        if (predicted != info.taken) { // give the branch an entry with a longer history
+            bool allocated = false;
+            for (int i = provider + 1; i < TAGE_TABLES && !allocated; i++) {
+                TageEntry& e = bp.tage[i][index[i]];
+                if (e.useful == 0) {
+                    e.tag = tag[i];
+                    e.ctr = info.taken ? 0 : -1;
+                    allocated = true;
                 }
-                PC = (PC + 1) & (MEM_SIZE - 1);
-            }
-            else if (bits_extracter(memory[PC], 4, 0) == 8) { // its a jr
-                regSrc = bits_extracter(memory[PC], 3, 10);
-                PC = (registers[regSrc]) & (MEM_SIZE - 1); // for the case where a val inside a register is more than 13 bits, ignore 3 most signif bits
             }
+            for (int i = provider + 1; i < TAGE_TABLES && !allocated; i++)
+                bp.tage[i][index[i]].useful = max(0, bp.tage[i][index[i]].useful - 1);
         }
-        else if (bits_extracter(memory[PC], 3, 13) == 4) { // its a LW *****************************************************************************************************
+    }
+    bp.history = (bp.history << 1) | (info.taken ? 1 : 0);
+    return predicted;
+}
 
-                
-                regAddr = bits_extracter(memory[PC], 3, 10);
-                regDst = bits_extracter(memory[PC], 3, 7);
-                imm = bits_extracter(memory[PC], 7, 0);
 
-                if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
-                    imm = (((~imm) & 127) + 1) * -1;
-                }
+/*
+    Runs an executed jeq, j, jal or jr through the branch predictor,
+    counting it as mispredicted if the predicted next pc was wrong.
 
-                if (regDst != 0) {
-                    registers[regDst] = (memory[(registers[regAddr] + imm) & (MEM_SIZE - 1)]) & (REG_SIZE - 1);
-                    // makes sure sum of regAddr and imm val stays in range of memory size
-                }
+    @return true if it was mispredicted
+*/
+bool predict_branch(BranchPredictor& bp, const ExecInfo& info) {
+    bool correct;
+    if (info.branch == BRANCH_JEQ) {
+        correct = predict_jeq(bp, info) == info.taken;
+    }
+    else {
+        size_t entry = info.pc % bp.btb_pc.size();
+        bool btb_hit = bp.btb_pc[entry] == int(info.pc);
+        unsigned target = bp.btb_target[entry];
+        if (info.branch == BRANCH_JR && !bp.ras.empty()) {
+            btb_hit = true;
+            target = bp.ras.back();
+            bp.ras.pop_back();
+        }
+        correct = btb_hit && target == info.next_pc;
+        bp.btb_pc[entry] = info.pc;
+        bp.btb_target[entry] = info.next_pc;
+        if (info.branch == BRANCH_JAL) {
+            if (bp.ras.size() == bp.ras_depth) // the oldest return address is lost
+                bp.ras.erase(bp.ras.begin());
+            bp.ras.push_back((info.pc + 1) & (MEM_SIZE - 1));
+        }
+    }
+    bp.pc_kind[info.pc] = info.branch;
+    bp.pc_executed[info.pc]++;
+    bp.kind_executed[info.branch]++;
+    if (!correct) {
+        bp.pc_mispredicts[info.pc]++;
+        bp.kind_mispredicts[info.branch]++;
+    }
+    return !correct;
+}
 
-                int addr = registers[regAddr] + imm;
 
-                int L1blockID = addr / L1blocksize;
-                int L1line = L1blockID % L1numlines; // % (L1size / L1blocksize)
+/*
+    A memory read waiting in, or scheduled by, the DRAM controller.
+*/
+struct DramRequest {
+    int bank;          // the bank of every channel, numbered channel first
+    int row;
+    uint64_t arrival;  // the cycle it reached the controller
+    uint64_t done = 0; // the cycle its data is back, 0 until it is scheduled
+};
 
-                int L2blockID = addr / L2blocksize;
-                int L2line = L2blockID % L2numlines;
 
-                
+// The most banks over all channels a --dram config may have
+int const static MAX_DRAM_BANKS = 1 << 16;
 
-                if (two_caches == false) {
-                    if (L1assoc == 1) { // if it just a direct mapped cache
-                        
-                        if (a1_L1cache[L1line] != (L1blockID / L1numlines)) { // if the new tag is not same as the tag currently in the cache, evict it with the new one. This will be a MISS
-                            a1_L1cache[L1line] = L1blockID / L1numlines;
-                            print_log_entry("L1", "MISS", PC, addr, L1line);
-                        }
-                        else {
-                            print_log_entry("L1", "HIT", PC, addr, L1line);
-                        }
-                           
-                    }
-                    else { // not direct mapped
-                        vector<int>::iterator location_neg1 = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), -1);
-                        vector<int>::iterator current_tag = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), L1blockID / L1numlines);
-                        
-
-                        if (location_neg1 != a_n_L1cache[L1line].end()) { // if -1 is found in the vector
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector add it at the -1 slot
-                                
-                                a_n_L1cache[L1line][(location_neg1)-(a_n_L1cache[L1line].begin())] = (L1blockID / L1numlines);
-                                print_log_entry("L1", "MISS", PC, addr, L1line);
-                                
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "HIT", PC, addr, L1line);
-                                
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                        }
-                        else { // -1 is not found in vector so we must evict stuff
-                            LRU_int = bookkeeping[L1line][0];
-                            
-                            LRU_iter = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), LRU_int);
-
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-                                
-                                a_n_L1cache[L1line][LRU_iter - a_n_L1cache[L1line].begin()] = L1blockID / L1numlines; // replace the new tag to where the LRU tag was
-                                bookkeeping[L1line].erase(find(bookkeeping[L1line].begin(), bookkeeping[L1line].end(), LRU_int)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                print_log_entry("L1", "MISS", PC, addr, L1line);
-                                
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "HIT", PC, addr, L1line);
-                                
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-
-            
-                        }
-                          // the a_n_cache (associativity of n >1) is represented as a vector of a vector of ints
-                        // the outer vector represents each line, the outer vector size depends on the numlines. The inner vector represents each tag, the inner vector size depends on the associativty
-                        // an associativity of 1 means we don't need an vec of vec of ints because each line will be limited to one tag
-                        // here's how to pop a first element. vec.erase(vec.begin());
+/*
+    The DRAM behind the last cache level for --dram. Block addresses are
+    split, from the low bits up, into the column of a row, the channel,
+    the bank and the row, so consecutive rows interleave over the channels
+    and banks. Each bank keeps its last row open in its row buffer with
+    the open-row policy, or precharges after every access with the
+    closed-row policy, and the controller picks the requests of each bank
+    first-ready first-come-first-served: the oldest that hits the open
+    row, or else the oldest. Each channel has one data bus.
+*/
+struct Dram {
+    bool enabled = false;
+    int channels = 1;
+    int banks = 8;                      // per channel
+    int row_size = 256;                 // words
+    bool open_row = true;
+    uint64_t t_rcd = 14;                // cycles to open a row
+    uint64_t t_cas = 14;                // from a read to its first data
+    uint64_t t_rp = 14;                 // to precharge, closing the open row
+    uint64_t t_burst = 4;               // cycles the data takes on the bus
+    uint64_t delay = 0;                 // cycles from the L1 to the controller
+    deque<DramRequest> requests;        // the unfinished requests, oldest first
+    uint64_t first_id = 0;              // the id of requests.front()
+    vector<vector<uint64_t>> waiting;   // the ids of the unscheduled requests of every bank
+    vector<int> bank_row;               // the open row of every bank, -1 if precharged
+    vector<uint64_t> bank_free;         // the cycle every bank can take its next read
+    vector<uint64_t> bus_free;          // the cycle every channel's data bus is free
+    uint64_t accesses = 0;
+    uint64_t row_hits = 0;
+    uint64_t row_empty = 0;             // reads to a precharged bank
+    uint64_t row_conflicts = 0;         // reads that closed another row first
+    uint64_t total_latency = 0;         // from arrival to done, over every read
+    uint64_t max_latency = 0;
+};
 
-                    }
 
-                }
-                else { // two caches
-                    if (L1assoc == 1) { // if it L1 just a direct mapped cache
-
-                        if (a1_L1cache[L1line] != (L1blockID / L1numlines)) { // if the new tag is not same as the tag currently in the cache, evict it with the new one. This will be a MISS
-                            a1_L1cache[L1line] = L1blockID / L1numlines;
-                            print_log_entry("L1", "MISS", PC, addr, L1line);
-                            if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                    a1_L2cache[L2line] = L2blockID / L2numlines;
-                                    print_log_entry("L2", "MISS", PC, addr, L2line);
-                                }
-                                else {
-                                    print_log_entry("L2", "HIT", PC, addr, L2line);
-                                }
-                            }
-                            else { // L2 not direct mapped but L1 is direct mapped
-                                vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
-
-                                if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                    if (current_tag_2 == a_n_L2cache[L2line].end()) {
-
-                                        a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                        print_log_entry("L2", "MISS", PC, addr, L2line);
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                    else {
-                                        print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                }
-                                else {
-                                    LRU_int2 = bookkeeping2[L2line][0];
-                                    LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
-
-                                    if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-
-                                        a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                        bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                        print_log_entry("L2", "MISS", PC, addr, L2line);
-
-                                        // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-
-                                    }
-                                    else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                        print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                        // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                }
-                            }
-                        }
-                        else {
-                            print_log_entry("L1", "HIT", PC, addr, L1line);
-                        }
+/*
+    Parses a DRAM config of the form CHANNELS,BANKS,ROW_SIZE,open|closed
+    optionally followed by ,tRCD,tCAS,tRP,tBURST. The timings may be 0,
+    except tBURST, and there may be at most MAX_DRAM_BANKS banks in all.
 
-                    }
-                    else { // L1 not direct mapped
-                        vector<int>::iterator location_neg1 = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), -1);
-                        vector<int>::iterator current_tag = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), L1blockID / L1numlines);
-
-                        
-
-
-                        if (location_neg1 != a_n_L1cache[L1line].end()) { // if -1 is found in the vector
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector add it at the -1 slot
-                                
-                                a_n_L1cache[L1line][(location_neg1)-(a_n_L1cache[L1line].begin())] = (L1blockID / L1numlines);
-                                print_log_entry("L1", "MISS", PC, addr, L1line);
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-
-
-
-                                // **********************************L2
-                                if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                    if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                        a1_L2cache[L2line] = L2blockID / L2numlines;
-                                        print_log_entry("L2", "MISS", PC, addr, L2line);
-                                    }
-                                    else {
-                                        print_log_entry("L2", "HIT", PC, addr, L2line);
-                                    }
-                                }
-                                else { // L2 not direct mapped but L1 is direct mapped
-                                    vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                    vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
-
-                                    if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) {
-
-                                            a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                            print_log_entry("L2", "MISS", PC, addr, L2line);
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                        else {
-                                            print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                    else {
-                                        LRU_int2 = bookkeeping2[L2line][0];
-                                        LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
-
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-
-                                            a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                            bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                            print_log_entry("L2", "MISS", PC, addr, L2line);
-
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-
-                                        }
-                                        else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                            print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                }
-                                // ************************L2
-
-
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "HIT", PC, addr, L1line);
-                                
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                        }
-                        else { // -1 is not found in vector so we must evict stuff
-                            LRU_int = bookkeeping[L1line][0];
-                            LRU_iter = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), LRU_int);
-
-                            
-
-
-
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-                                
-                                a_n_L1cache[L1line][LRU_iter - a_n_L1cache[L1line].begin()] = L1blockID / L1numlines; // replace the new tag to where the LRU tag was
-                                bookkeeping[L1line].erase(find(bookkeeping[L1line].begin(), bookkeeping[L1line].end(), LRU_int)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                print_log_entry("L1", "MISS", PC, addr, L1line);
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-
-                                //*********L2
-                                if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                    if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                        a1_L2cache[L2line] = L2blockID / L2numlines;
-                                        print_log_entry("L2", "MISS", PC, addr, L2line);
-                                    }
-                                    else {
-                                        print_log_entry("L2", "HIT", PC, addr, L2line);
-                                    }
-                                }
-                                else { // L2 not direct mapped but L1 is direct mapped
-                                    vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                    vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
-
-                                    if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) {
-
-                                            a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                            print_log_entry("L2", "MISS", PC, addr, L2line);
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                        else {
-                                            print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                    else {
-                                        LRU_int2 = bookkeeping2[L2line][0];
-                                        LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
-
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-
-                                            a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                            bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                            print_log_entry("L2", "MISS", PC, addr, L2line);
-
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-
-                                        }
-                                        else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                            print_log_entry("L2", "HIT", PC, addr, L2line);
-
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                }
-                                //***************L2
-
-
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "HIT", PC, addr, L1line);
-                                
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-
-
-                        }
-                        
+    @return Whether the config was valid
+*/
+bool parse_dram_config(const string& config, Dram& d) {
+    vector<string> parts;
+    size_t pos;
+    size_t lastpos = 0;
+    while ((pos = config.find(",", lastpos)) != string::npos) {
+        parts.push_back(config.substr(lastpos, pos - lastpos));
+        lastpos = pos + 1;
+    }
+    parts.push_back(config.substr(lastpos));
+    if (parts.size() != 4 && parts.size() != 8)
+        return false;
+    if (parts[3] != "open" && parts[3] != "closed")
+        return false;
+    d.open_row = parts[3] == "open";
+    int timing[4] = { int(d.t_rcd), int(d.t_cas), int(d.t_rp), int(d.t_burst) };
+    if (!parse_int_arg(parts[0], 1, d.channels) || !parse_int_arg(parts[1], 1, d.banks) ||
+        !parse_int_arg(parts[2], 1, d.row_size))
+        return false;
+    for (size_t i = 4; i < parts.size(); i++)
+        if (!parse_int_arg(parts[i], i == 7 ? 1 : 0, timing[i - 4]))
+            return false;
+    if (d.banks > MAX_DRAM_BANKS / d.channels)
+        return false;
+    d.t_rcd = timing[0];
+    d.t_cas = timing[1];
+    d.t_rp = timing[2];
+    d.t_burst = timing[3];
+    int total = d.channels * d.banks;
+    d.waiting.assign(total, {});
+    d.bank_row.assign(total, -1);
+    d.bank_free.assign(total, 0);
+    d.bus_free.assign(d.channels, 0);
+    d.enabled = true;
+    return true;
+}
 
-                    }
-                } // two caches if statement
 
+/*
+    Queues a read of the row holding addr. Like the E20's memory, the DRAM
+    holds MEM_SIZE cells, so addr is first masked to the cell it reads.
+
+    @param arrival The cycle the read reaches the controller. Must not be
+                   before that of an earlier read
 
+    @return The id of the request, see dram_done()
+*/
+uint64_t dram_request(Dram& d, int addr, uint64_t arrival) {
+    int rest = (addr & (MEM_SIZE - 1)) / d.row_size; // the cache may see an address out of range, even negative
+    int channel = rest % d.channels;
+    rest /= d.channels;
+    DramRequest r;
+    r.bank = channel * d.banks + rest % d.banks;
+    r.row = rest / d.banks;
+    r.arrival = arrival;
+    uint64_t id = d.first_id + d.requests.size();
+    d.requests.push_back(r);
+    d.waiting[r.bank].push_back(id);
+    return id;
+}
 
-                PC = (PC + 1) & (MEM_SIZE - 1);
 
-                // in the case PC is past 8192, make sure 3 most significant bits are ignored
+/*
+    Schedules the read that can start soonest over all the banks. Its bank
+    picks it first-ready first-come-first-served among the reads that have
+    arrived by the time the bank is free.
+*/
+void dram_schedule_next(Dram& d) {
+    int bank = -1;
+    uint64_t start = 0;
+    for (size_t b = 0; b < d.waiting.size(); b++) {
+        if (d.waiting[b].empty())
+            continue;
+        uint64_t t = max(d.bank_free[b], d.requests[d.waiting[b].front() - d.first_id].arrival);
+        if (bank < 0 || t < start) {
+            bank = b;
+            start = t;
+        }
+    }
+    vector<uint64_t>& queue = d.waiting[bank];
+    size_t pick = 0;
+    if (d.open_row) {
+        for (size_t i = 0; i < queue.size(); i++) {
+            const DramRequest& r = d.requests[queue[i] - d.first_id];
+            if (r.arrival > start)
+                break;
+            if (r.row == d.bank_row[bank]) {
+                pick = i;
+                break;
+            }
         }
-        else if (bits_extracter(memory[PC], 3, 13) == 5) { // its an SW **************************************************************************************
-                regAddr = bits_extracter(memory[PC], 3, 10);
-                regSrc = bits_extracter(memory[PC], 3, 7);
-                imm = bits_extracter(memory[PC], 7, 0);
+    }
+    DramRequest& r = d.requests[queue[pick] - d.first_id];
+    queue.erase(queue.begin() + pick);
 
-                if (bits_extracter(imm, 1, 6) == 1) { // imm val msb is 1, should be negative
-                    imm = (((~imm) & 127) + 1) * -1;
-                }
+    uint64_t latency = d.t_cas;
+    if (!d.open_row || d.bank_row[bank] < 0) {
+        latency += d.t_rcd;
+        d.row_empty++;
+    }
+    else if (d.bank_row[bank] != r.row) {
+        latency += d.t_rp + d.t_rcd;
+        d.row_conflicts++;
+    }
+    else
+        d.row_hits++;
+    // the next read of the bank can follow once this one's data is on its way
+    d.bank_free[bank] = start + latency - d.t_cas + d.t_burst + (d.open_row ? 0 : d.t_rp);
+    d.bank_row[bank] = d.open_row ? r.row : -1;
+    uint64_t& bus = d.bus_free[bank / d.banks];
+    r.done = max(start + latency, bus) + d.t_burst;
+    bus = r.done;
+    d.accesses++;
+    d.total_latency += r.done - r.arrival;
+    d.max_latency = max(d.max_latency, r.done - r.arrival);
+}
 
-                memory[(registers[regAddr] + imm) & (MEM_SIZE - 1)] = registers[regSrc]; // memory pointer must be in 13 bit range
-                int addr = registers[regAddr] + imm;
-                int L1blockID = addr / L1blocksize;
-                int L1line = L1blockID % L1numlines; 
-
-                int L2blockID = addr / L2blocksize;
-                int L2line = L2blockID % L2numlines;
-
-                
-                // Since code is repeated from LW's cache implementation, most of the comments are removed
-                if (two_caches == false) {  // has only one L1 cache
-                    if (L1assoc == 1) {
-                        if (a1_L1cache[L1line] != (L1blockID / L1numlines)) { // if the new tag is not same as the tag currently in the cache, evict it with the new one. T
-                            a1_L1cache[L1line] = L1blockID / L1numlines;
-                            print_log_entry("L1", "SW", PC, addr, L1line);
-                        }
-                        else {
-                            print_log_entry("L1", "SW", PC, addr, L1line);
-                        }
-                    }
-                    else {
-                        vector<int>::iterator location_neg1 = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), -1);
-                        vector<int>::iterator current_tag = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), L1blockID / L1numlines);
-
-
-                        if (location_neg1 != a_n_L1cache[L1line].end()) { // if -1 is found in the vector
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector add it at the -1 slot
-                                
-                                a_n_L1cache[L1line][(location_neg1)-(a_n_L1cache[L1line].begin())] = (L1blockID / L1numlines);
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                        }
-                        else { // -1 is not found in vector so we must evict stuff
-                            LRU_int = bookkeeping[L1line][0];
-                            
-                            LRU_iter = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), LRU_int);
-
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-                                
-                                a_n_L1cache[L1line][LRU_iter - a_n_L1cache[L1line].begin()] = L1blockID / L1numlines; // replace the new tag to where the LRU tag was
-                                bookkeeping[L1line].erase(find(bookkeeping[L1line].begin(), bookkeeping[L1line].end(), LRU_int)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-
-
-                        }
-                    }
-                    //print_log_entry("L1", "SW", PC, addr, L1line);
-                    
-                } 
-                else {  // has both L1 and L2 caches
-
-                    // LW's 2 CACHE CODE, but EVERY log entry is SW (instead of HIT OR MISS) vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv
-                    if (L1assoc == 1) { // if it L1 just a direct mapped cache
-
-                        if (a1_L1cache[L1line] != (L1blockID / L1numlines)) { // if the new tag is not same as the tag currently in the cache, evict it with the new one. This will be a SW
-                            a1_L1cache[L1line] = L1blockID / L1numlines;
-                            print_log_entry("L1", "SW", PC, addr, L1line);
-                            if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                    a1_L2cache[L2line] = L2blockID / L2numlines;
-                                    print_log_entry("L2", "SW", PC, addr, L2line);
-                                }
-                                else {
-                                    print_log_entry("L2", "SW", PC, addr, L2line);
-                                }
-                            }
-                            else { // L2 not direct mapped but L1 is direct mapped
-                                vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
-
-                                if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                    if (current_tag_2 == a_n_L2cache[L2line].end()) {
-
-                                        a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                    else {
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                }
-                                else {
-                                    LRU_int2 = bookkeeping2[L2line][0];
-                                    LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
-
-                                    if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-
-                                        a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                        bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-
-                                        // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-
-                                    }
-                                    else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-
-                                        // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                        update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                    }
-                                }
-                            }
-                        }
-                        else {
-                            print_log_entry("L1", "SW", PC, addr, L1line);
-                            print_log_entry("L2", "SW", PC, addr, L2line);
-                        }
 
-                    }
-                    else { // L1 not direct mapped
-                        vector<int>::iterator location_neg1 = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), -1);
-                        vector<int>::iterator current_tag = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), L1blockID / L1numlines);
+/*
+    Schedules reads until a request is done. Reads queued after it never
+    go ahead of it, which is exact for the blocking pipeline as it stalls
+    until the data is back, and leaves the non-blocking one scheduling
+    first-come-first-served against the lws it issues later.
 
+    @param id The request, from dram_request()
+
+    @return The cycle its data is back
+*/
+uint64_t dram_done(Dram& d, uint64_t id) {
+    while (d.requests[id - d.first_id].done == 0)
+        dram_schedule_next(d);
+    uint64_t done = d.requests[id - d.first_id].done;
+    while (!d.requests.empty() && d.requests.front().done != 0) {
+        d.requests.pop_front();
+        d.first_id++;
+    }
+    return done;
+}
 
 
+/*
+    Schedules every queued read, such as those of the stores at the end of
+    the program that nothing waited for, so the counts cover them.
+*/
+void dram_drain(Dram& d) {
+    if (!d.requests.empty())
+        dram_done(d, d.first_id + d.requests.size() - 1);
+    for (const vector<uint64_t>& queue : d.waiting)
+        if (!queue.empty())
+            dram_done(d, queue.back());
+}
 
-                        if (location_neg1 != a_n_L1cache[L1line].end()) { // if -1 is found in the vector
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector add it at the -1 slot
 
-                                a_n_L1cache[L1line][(location_neg1)-(a_n_L1cache[L1line].begin())] = (L1blockID / L1numlines);
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
+/*
+    Times the program on a classic 5-stage in-order pipeline (fetch,
+    decode, execute, memory, writeback) with full forwarding. Every
+    instruction takes one cycle, plus a cycle when it uses the register a
+    lw just before it loaded, plus the cycles its fetch and its lw spend
+    beyond an L1 hit in the level that held the block, plus the penalty of
+    a mispredicted branch. Stores retire into a write buffer and do not
+    stall. Without --branch, jumps and taken jeqs pay the penalty as if
+    the pipeline always predicted the next instruction.
+
+    With --mshr the data caches do not block on a lw miss. The miss takes
+    a miss status holding register of each level it misses, and only the
+    instructions that read or write the loaded register wait for it. A
+    later lw of a block that is still being fetched merges into its MSHR,
+    and a miss that finds every MSHR of a level busy waits for one.
+
+    With --tlb a lw or sw that misses the DTLB1 waits for its translation
+    before it goes to the data cache.
+
+    With --dram the fetches and lws that go to memory take as long as the
+    DRAM needs to read their row instead of the memory latency, and the
+    stores that miss every level read their block without stalling.
+*/
+struct Pipeline {
+    bool enabled = false;
+    uint64_t latency[3] = { 1, 10, 100 }; // cycles of an L1 hit, an L2 hit and a memory access
+    uint64_t penalty = 2;                 // cycles lost on a mispredict
+    unsigned load_dst = 0;                // the register the previous instruction loaded, 0 if none
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t load_use = 0;                // stall cycles of each kind
+    uint64_t fetch_stall = 0;
+    uint64_t data_stall = 0;
+    uint64_t branch_stall = 0;
+    bool translates = false;              // whether there are TLBs, see --tlb
+    uint64_t translate_stall = 0;
+    vector<uint64_t> pc_instructions;
+    vector<uint64_t> pc_cycles;
+    int mshrs[2] = { 0, 0 };                    // MSHRs of L1 and L2, 0 for blocking caches
+    int blocksize[2] = { 1, 1 };                // of L1 and L2, to find the misses that merge
+    vector<pair<int, uint64_t>> outstanding[2]; // the block and arrival cycle of every busy MSHR
+    uint64_t reg_ready[NUM_REGS] = {};          // the cycle each register's pending lw can be used
+    bool reg_missed[NUM_REGS] = {};             // whether that lw missed
+    uint64_t merged = 0;                        // lw misses merged into a busy MSHR
+    uint64_t mshr_stall = 0;                    // cycles waiting for a free MSHR
+    uint64_t miss_cycles = 0;                   // the summed latency of the misses that took an L1 MSHR
+    uint64_t busy_cycles = 0;                   // cycles with at least one of them outstanding
+    uint64_t busy_until = 0;
+    Dram* dram = nullptr;                       // the DRAM behind the caches, null for a fixed memory latency
+};
 
 
+/*
+    Finds the MSHR of a level that is fetching a block, after freeing the
+    MSHRs whose block arrived by cycle now.
 
-                                // **********************************
-                                if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                    if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                        a1_L2cache[L2line] = L2blockID / L2numlines;
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-                                    }
-                                    else {
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-                                    }
-                                }
-                                else { // L2 not direct mapped but L1 is direct mapped
-                                    vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                    vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
+    @return The cycle the block arrives, or 0 if no MSHR is fetching it
+*/
+uint64_t mshr_pending(Pipeline& p, int level, int block, uint64_t now) {
+    vector<pair<int, uint64_t>>& busy = p.outstanding[level];
+    busy.erase(remove_if(busy.begin(), busy.end(),
+        [&](const pair<int, uint64_t>& mshr) { return mshr.second <= now; }), busy.end());
+    for (const pair<int, uint64_t>& mshr : busy)
+        if (mshr.first == block)
+            return mshr.second;
+    return 0;
+}
 
-                                    if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) {
 
-                                            a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                        else {
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
-
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                    else {
-                                        LRU_int2 = bookkeeping2[L2line][0];
-                                        LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
+/*
+    Waits for a free MSHR of a level, counting the cycles waited as stalls.
 
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
+    @param now The current cycle, moved on to when an MSHR is free
+*/
+void mshr_wait(Pipeline& p, int level, uint64_t& now) {
+    vector<pair<int, uint64_t>>& busy = p.outstanding[level];
+    if (int(busy.size()) < p.mshrs[level])
+        return;
+    uint64_t free = min_element(busy.begin(), busy.end(),
+        [](const pair<int, uint64_t>& a, const pair<int, uint64_t>& b) { return a.second < b.second; })->second;
+    p.mshr_stall += free - now;
+    now = free;
+    mshr_pending(p, level, -1, now);
+}
 
-                                            a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                            bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
 
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
+/*
+    Finds the cycles an access to memory takes beyond an L1 hit.
 
-                                        }
-                                        else { // if the current tag is already in the cache vector, it's a SW (so print) and push it to bookkeeping (since it was just accessed)
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
+    @param now The cycle the access leaves the L1
+*/
+uint64_t memory_stall(Pipeline& p, int addr, uint64_t now) {
+    if (p.dram == nullptr)
+        return p.latency[2] - p.latency[0];
+    return dram_done(*p.dram, dram_request(*p.dram, addr, now + p.dram->delay)) - now;
+}
 
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                }
-                                // ************************
 
+/*
+    Adds the cycles of one executed instruction to the pipeline timing
+    when the data caches are non-blocking, see pipeline_step().
+*/
+void pipeline_step_nonblocking(Pipeline& p, const ExecInfo& info, int fetch_level, int data_level, bool redirect,
+    uint64_t translate) {
+    uint64_t start = p.cycles;
+    uint64_t now = start + (fetch_level == 2 ? memory_stall(p, info.pc, start) : p.latency[fetch_level] - p.latency[0]);
+    p.fetch_stall += now - start;
+    for (unsigned reg = 1; reg < NUM_REGS; reg++) { // wait for the pending lws this instruction depends on
+        if ((info.reads >> reg & 1 || reg == info.dst) && p.reg_ready[reg] > now) {
+            (p.reg_missed[reg] ? p.data_stall : p.load_use) += p.reg_ready[reg] - now;
+            now = p.reg_ready[reg];
+        }
+    }
+    if (info.dst != 0)
+        p.reg_ready[info.dst] = 0;
+    now += translate;
+    p.translate_stall += translate;
+
+    if (info.is_load) {
+        uint64_t arrives = 0; // when the block is in L1, 0 if it already is
+        int block = info.addr / p.blocksize[0];
+        uint64_t pending = mshr_pending(p, 0, block, now);
+        if (pending > 0) {
+            arrives = pending;
+            p.merged++;
+        }
+        else if (data_level > 0) {
+            mshr_wait(p, 0, now);
+            bool dram = data_level == 2 && p.dram != nullptr; // the L2 MSHR, if any, asks the DRAM below
+            arrives = now + 1 + (dram && p.mshrs[1] == 0 ? memory_stall(p, info.addr, now + 1) :
+                p.latency[dram ? 1 : data_level] - p.latency[0]);
+            if (p.mshrs[1] > 0) {
+                int block2 = info.addr / p.blocksize[1];
+                pending = mshr_pending(p, 1, block2, now);
+                if (pending > 0) {
+                    arrives = max(arrives, pending);
+                    p.merged++;
+                }
+                else if (data_level == 2) {
+                    mshr_wait(p, 1, now);
+                    arrives = now + 1 + memory_stall(p, info.addr, now + 1);
+                    p.outstanding[1].push_back({ block2, arrives });
+                }
+            }
+            p.outstanding[0].push_back({ block, arrives });
+            p.miss_cycles += arrives - now;
+            if (arrives > max(now, p.busy_until))
+                p.busy_cycles += arrives - max(now, p.busy_until);
+            p.busy_until = max(p.busy_until, arrives);
+        }
+        if (info.dst != 0) {
+            p.reg_ready[info.dst] = max(now + 1, arrives) + 1;
+            p.reg_missed[info.dst] = arrives > now + 1;
+        }
+    }
+    else if (info.is_store && data_level == 2 && p.dram != nullptr)
+        dram_request(*p.dram, info.addr, now + 1 + p.dram->delay);
 
-                            }
-                            else { // if the current tag is already in the cache vector, it's a SW (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "SW", PC, addr, L1line);
+    if (redirect) {
+        now += p.penalty;
+        p.branch_stall += p.penalty;
+    }
+    p.cycles = now + 1;
+    p.instructions++;
+    p.pc_instructions[info.pc]++;
+    p.pc_cycles[info.pc] += p.cycles - start;
+}
 
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                        }
-                        else { // -1 is not found in vector so we must evict stuff
-                            LRU_int = bookkeeping[L1line][0];
-                            LRU_iter = find(a_n_L1cache[L1line].begin(), a_n_L1cache[L1line].end(), LRU_int);
 
+/*
+    Adds the cycles of one executed instruction to the pipeline timing.
 
+    @param fetch_level Where the instruction came from: 0 for L1, 1 for L2 and 2 for memory
 
+    @param data_level Where the block of a lw came from, the same way
 
+    @param redirect Whether the instruction sent the pipeline down the wrong path
 
-                            if (current_tag == a_n_L1cache[L1line].end()) { // if the current tag is not already in the vector put it at the LRU slot
+    @param translate The cycles the TLBs took to translate the address of a lw or sw
+*/
+void pipeline_step(Pipeline& p, const ExecInfo& info, int fetch_level, int data_level, bool redirect,
+    uint64_t translate = 0) {
+    if (p.pc_cycles.empty()) {
+        p.pc_instructions.assign(MEM_SIZE, 0);
+        p.pc_cycles.assign(MEM_SIZE, 0);
+        p.cycles += 4; // filling the pipeline
+    }
+    if (p.mshrs[0] > 0) {
+        pipeline_step_nonblocking(p, info, fetch_level, data_level, redirect, translate);
+        return;
+    }
+    uint64_t cycles = 1;
+    if (p.load_dst != 0 && (info.reads >> p.load_dst & 1)) {
+        cycles++;
+        p.load_use++;
+    }
+    uint64_t stall = fetch_level == 2 ? memory_stall(p, info.pc, p.cycles) : p.latency[fetch_level] - p.latency[0];
+    cycles += stall;
+    p.fetch_stall += stall;
+    cycles += translate;
+    p.translate_stall += translate;
+    if (info.is_load) {
+        stall = data_level == 2 ? memory_stall(p, info.addr, p.cycles + cycles) : p.latency[data_level] - p.latency[0];
+        cycles += stall;
+        p.data_stall += stall;
+    }
+    else if (info.is_store && data_level == 2 && p.dram != nullptr)
+        dram_request(*p.dram, info.addr, p.cycles + cycles + p.dram->delay);
+    if (redirect) {
+        cycles += p.penalty;
+        p.branch_stall += p.penalty;
+    }
+    p.load_dst = info.is_load ? info.dst : 0;
+    p.instructions++;
+    p.cycles += cycles;
+    p.pc_instructions[info.pc]++;
+    p.pc_cycles[info.pc] += cycles;
+}
 
-                                a_n_L1cache[L1line][LRU_iter - a_n_L1cache[L1line].begin()] = L1blockID / L1numlines; // replace the new tag to where the LRU tag was
-                                bookkeeping[L1line].erase(find(bookkeeping[L1line].begin(), bookkeeping[L1line].end(), LRU_int)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                print_log_entry("L1", "SW", PC, addr, L1line);
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
 
-                                //*********
-                                if (L2assoc == 1) { // both L1 and L2 are direct mapped
-                                    if (a1_L2cache[L2line] != (L2blockID / L2numlines)) {
-                                        a1_L2cache[L2line] = L2blockID / L2numlines;
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-                                    }
-                                    else {
-                                        print_log_entry("L2", "SW", PC, addr, L2line);
-                                    }
-                                }
-                                else { // L2 not direct mapped but L1 is direct mapped
-                                    vector<int>::iterator location_neg1_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), -1);
-                                    vector<int>::iterator current_tag_2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), L2blockID / L2numlines);
+int const static TLB_LEAF_ENTRIES = 16; // pages mapped by each leaf of the page table
 
-                                    if (location_neg1_2 != a_n_L2cache[L2line].end()) {
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) {
+/*
+    The data TLBs of --tlb, which translate the address of every lw and sw
+    before it goes to the data caches. Each TLB level is a cache whose
+    blocks are pages, so an entry is the tag of one page. A miss in every
+    level walks a two level page table at the top of memory: a root
+    entry for each TLB_LEAF_ENTRIES pages, then the leaf entry of the
+    page. The walk reads both entries through the data caches, like lws
+    of the pc that missed. Translation is the identity, only its cost is
+    simulated.
+*/
+struct Tlb {
+    bool enabled = false;
+    vector<Cache> levels;                 // DTLB1, then DTLB2 if there is one
+    int page_size = 0;
+    int root_entries = 0;
+    int table_base = 0;                   // the address of the root, followed by the leaves
+    uint64_t latency[3] = { 1, 10, 100 }; // cycles of a walk read served by L1, L2 and memory
+    uint64_t walks = 0;
+    uint64_t walk_reads = 0;              // reads of each level, by where they were served
+    uint64_t walk_levels[3] = {};
+    uint64_t walk_cycles = 0;
+    vector<uint64_t> pc_accesses;         // per pc, allocated on the first translation
+    vector<uint64_t> pc_misses;           // DTLB1 misses
+    vector<uint64_t> pc_walks;
+    vector<uint64_t> pc_cycles;           // cycles spent translating, walks and DTLB2 hits
+};
 
-                                            a_n_L2cache[L2line][(location_neg1_2)-(a_n_L2cache[L2line].begin())] = (L2blockID / L2numlines);
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                        else {
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
 
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                    else {
-                                        LRU_int2 = bookkeeping2[L2line][0];
-                                        LRU_iter2 = find(a_n_L2cache[L2line].begin(), a_n_L2cache[L2line].end(), LRU_int2);
-
-                                        if (current_tag_2 == a_n_L2cache[L2line].end()) { // if the current tag is not already in the vector put it at the LRU slot
-
-                                            a_n_L2cache[L2line][LRU_iter2 - a_n_L2cache[L2line].begin()] = L2blockID / L2numlines; // replace the new tag to where the LRU tag was
-                                            bookkeeping2[L2line].erase(find(bookkeeping2[L2line].begin(), bookkeeping2[L2line].end(), LRU_int2)); //LRU tag is evicted so you need to remove it from bookkeeping because its no longer in the cache!
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
+/*
+    Everything simulated alongside the program: the data caches, with
+    --icache an instruction cache that every fetch goes through, with
+    --tlb the data TLBs in front of them, with --branch a branch
+    predictor, with --pipeline the pipeline timing and with --dram the
+    DRAM it reads memory from.
+*/
+struct Simulation {
+    vector<Cache> caches;           // the data caches, L1 first. May be empty
+    Cache icache;                   // the instruction cache, used only when it has lines
+    bool unified = false;           // instruction cache misses go on to the data L2
+    int last_fetch_block = -1;      // the block, or sector, of the previous fetch, see simulate_fetch()
+    Tlb tlb;
+    BranchPredictor branches;
+    Pipeline pipeline;
+    Dram dram;                      // pipeline.dram points here when it is enabled
+};
 
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
 
-                                        }
-                                        else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                            print_log_entry("L2", "SW", PC, addr, L2line);
+/*
+    Simulates the fetch of the instruction at pc against the instruction
+    cache, and on a miss against the data L2 when it is unified. Fetches
+    mostly fall through the block of the previous fetch, which is still
+    the most recently used tag of its line as only fetches touch the
+    instruction cache, so those are counted as hits without a lookup.
 
-                                            // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                            update_bookkeeping(bookkeeping2[L2line], (L2blockID / L2numlines));
-                                        }
-                                    }
-                                }
-                                //***************
+    @param sim The simulation. Its instruction cache must have lines
 
+    @param pc The address of the instruction
 
-                            }
-                            else { // if the current tag is already in the cache vector, it's a HIT (so print) and push it to bookkeeping (since it was just accessed)
-                                print_log_entry("L1", "SW", PC, addr, L1line);
+    @param log Whether to print a log entry for each level accessed
 
-                                // then update bookkeeping (append the "just accessed" tag to the bookkeeping vector)
-                                update_bookkeeping(bookkeeping[L1line], (L1blockID / L1numlines));
-                            }
-                            
+    @return Where the instruction came from: 0 for I1, 1 for the L2 and 2 for memory
+*/
+int simulate_fetch(Simulation& sim, int pc, bool log) {
+    Cache& ic = sim.icache;
+    int blockID = pc / ic.blocksize;
+    int line = blockID % ic.numlines;
+    int fetched = ic.sector_size > 0 ? pc / ic.sector_size : blockID; // the unit the fast path may skip
+    bool hit = true;
+    uint64_t t = stats_clock();
+    int partition = ic.partitions.empty() ? -1 : find_partition(ic, pc, pc);
+    if (fetched != sim.last_fetch_block) {
+        hit = cache_access(ic, pc, line, partition);
+        sim.last_fetch_block = fetched;
+        if (ic.classes.enabled) {
+            MissClass kind = classify_access(ic.classes, blockID);
+            if (!hit) {
+                if (kind == MISS_COMPULSORY)
+                    ic.classes.compulsory++;
+                else if (kind == MISS_CAPACITY)
+                    ic.classes.capacity_misses++;
+                else
+                    ic.classes.conflict++;
+            }
+        }
+    }
+    stats.lookup_ns += stats_clock() - t;
+    hit ? ic.hits++ : ic.misses++;
+    if (partition >= 0)
+        hit ? ic.partitions[partition].hits++ : ic.partitions[partition].misses++;
+    if (log) {
+        t = stats_clock();
+        print_log_entry(ic.name, hit ? "HIT" : "MISS", pc, pc, line);
+        stats.output_ns += stats_clock() - t;
+    }
+    if (hit)
+        return 0;
+    if (!sim.unified)
+        return 2;
 
-                        }
+    Cache& l2 = sim.caches[1];
+    if (l2.sample_ratio > 1 && !line_sampled(l2, cache_line_of(l2, pc)))
+        return 1;
+    t = stats_clock();
+    hit = cache_access(l2, pc, line, l2.partitions.empty() ? -1 : find_partition(l2, pc, pc));
+    if (l2.classes.enabled)
+        classify_access(l2.classes, pc / l2.blocksize); // keeps the shadow cache in step, only lw misses are counted
+    stats.lookup_ns += stats_clock() - t;
+    hit ? l2.fetch_hits++ : l2.fetch_misses++;
+    if (log) {
+        t = stats_clock();
+        print_log_entry(l2.name, hit ? "HIT" : "MISS", pc, pc, line);
+        stats.output_ns += stats_clock() - t;
+    }
+    return hit ? 1 : 2;
+}
 
 
-                    }
+/*
+    Sets up the TLBs of a --tlb configuration and places the page table.
 
-                    // LW's TWO CACHE ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-                    
-                } // two_caches if statement
+    @param config L1_ENTRIES,L1_ASSOC,PAGE_SIZE optionally followed by
+        ,L2_ENTRIES,L2_ASSOC for a second level
 
-                
-                PC = (PC + 1) & (MEM_SIZE - 1);
-        }
-        else if (bits_extracter(memory[PC], 3, 13) == 2) { // its a j
-            if (check_if_halt(memory[PC], PC) == false) {
-                PC = (bits_extracter(memory[PC], 13, 0)) & (MEM_SIZE - 1);
-            }
-            else {
-                PC = (PC + 1) & (MEM_SIZE - 1); // When its a halt, increment PC and then stop simulation. Keeps PC in approriate bit range
-                break; // end simulation (while loop)
-            }
+    @return false if the configuration is invalid
+*/
+bool parse_tlb_config(const string& config, Tlb& tlb) {
+    vector<int> parts;
+    size_t pos;
+    size_t lastpos = 0;
+    try {
+        while ((pos = config.find(",", lastpos)) != string::npos) {
+            parts.push_back(stoi(config.substr(lastpos, pos - lastpos)));
+            lastpos = pos + 1;
         }
-        else if (bits_extracter(memory[PC], 3, 13) == 3) { // its a jal
-            imm = bits_extracter(memory[PC], 13, 0);
+        parts.push_back(stoi(config.substr(lastpos)));
+    } catch (const exception&) {
+        return false;
+    }
+    if (parts.size() != 3 && parts.size() != 5)
+        return false;
+    int page_size = parts[2];
+    if (page_size < 2 || page_size > int(MEM_SIZE))
+        return false;
+    parts.erase(parts.begin() + 2);
+    tlb.levels.resize(parts.size() / 2);
+    for (size_t level = 0; level < tlb.levels.size(); level++) {
+        int entries = parts[2 * level];
+        int assoc = parts[2 * level + 1];
+        // the TLB is a cache of entries * page_size cells, bounded like any other cache
+        if (entries < 1 || assoc < 1 || entries % assoc != 0 || entries > MAX_CACHE_SIZE / page_size)
+            return false;
+        init_cache(tlb.levels[level], level == 0 ? "DTLB1" : "DTLB2", entries * page_size, assoc, page_size);
+    }
+    int pages = (MEM_SIZE + page_size - 1) / page_size;
+    tlb.page_size = page_size;
+    tlb.root_entries = (pages + TLB_LEAF_ENTRIES - 1) / TLB_LEAF_ENTRIES;
+    tlb.table_base = MEM_SIZE - tlb.root_entries - pages;
+    tlb.enabled = true;
+    return true;
+}
+
+
+/*
+    Translates the address of a lw or sw through the TLBs, walking the
+    page table through the data caches when every TLB misses. A DTLB2 hit
+    costs as much as an L1 hit.
+
+    @param pc The address of the lw or sw
+
+    @param addr The address it accesses
 
-            registers[7] = PC + 1;
+    @param log Whether to print a log entry for each TLB and cache accessed
 
-            PC = imm & (MEM_SIZE - 1);
+    @return The cycles the translation took beyond a DTLB1 hit
+*/
+uint64_t simulate_translation(Simulation& sim, int pc, int addr, bool log) {
+    Tlb& tlb = sim.tlb;
+    if (tlb.pc_accesses.empty()) {
+        tlb.pc_accesses.assign(MEM_SIZE, 0);
+        tlb.pc_misses.assign(MEM_SIZE, 0);
+        tlb.pc_walks.assign(MEM_SIZE, 0);
+        tlb.pc_cycles.assign(MEM_SIZE, 0);
+    }
+    tlb.pc_accesses[pc]++;
+    uint64_t cycles = 0;
+    int cell = addr & (MEM_SIZE - 1); // the E20 reads this cell for an address out of range, even a negative one
+    for (size_t level = 0; level < tlb.levels.size(); level++) {
+        Cache& c = tlb.levels[level];
+        int line;
+        bool hit = cache_access(c, cell, line);
+        hit ? c.hits++ : c.misses++;
+        if (log)
+            print_log_entry(c.name, hit ? "HIT" : "MISS", pc, addr, line);
+        if (level == 0 && !hit)
+            tlb.pc_misses[pc]++;
+        if (hit) {
+            cycles = level == 0 ? 0 : tlb.latency[0];
+            tlb.pc_cycles[pc] += cycles;
+            return cycles;
         }
+    }
 
+    int page = cell / tlb.page_size;
+    int reads[2] = { tlb.table_base + page / TLB_LEAF_ENTRIES, tlb.table_base + tlb.root_entries + page };
+    for (int read : reads) {
+        int level = simulate_access(sim.caches, false, pc, read, log);
+        if (level == int(sim.caches.size()))
+            level = 2; // memory
+        tlb.walk_levels[level]++;
+        cycles += tlb.latency[level];
     }
+    tlb.walks++;
+    tlb.walk_reads += 2;
+    tlb.walk_cycles += cycles;
+    tlb.pc_walks[pc]++;
+    tlb.pc_cycles[pc] += cycles;
+    return cycles;
+}
+
+
+/*
+    Returns the cache of a simulation with the given name, L1, L2 or I1,
+    or null if there is none.
+*/
+Cache* find_cache(Simulation& sim, const string& name) {
+    for (Cache& c : sim.caches)
+        if (c.name == name)
+            return &c;
+    if (sim.icache.numlines > 0 && sim.icache.name == name)
+        return &sim.icache;
+    return nullptr;
+}
+
+
+/*
+    Makes the cache a --sector configuration names sectored.
 
+    @param config LEVEL,SECTOR_SIZE where SECTOR_SIZE divides the blocksize
+        of the level into at most 32 sectors
+
+    @param sim The simulation, with its caches set up
+
+    @return false if the configuration is invalid
+*/
+bool parse_sector_config(const string& config, Simulation& sim) {
+    size_t comma = config.find(",");
+    if (comma == string::npos)
+        return false;
+    Cache* c = find_cache(sim, config.substr(0, comma));
+    int sector_size = 0;
+    if (!parse_int_arg(config.substr(comma + 1), 1, sector_size))
+        return false;
+    if (c == nullptr || sector_size < 1 || c->blocksize % sector_size != 0 || c->blocksize / sector_size > 32)
+        return false;
+    c->sector_size = sector_size;
+    return true;
+}
+
+
+/*
+    Adds a --partition to the cache it names.
+
+    @param config LEVEL,MASK,pc|addr,LO,HI where LEVEL is L1, L2 or I1,
+        MASK has a bit set for every way the partition may fill, such as
+        0x3 for ways 0 and 1, and LO-HI is the range of pcs or data
+        addresses whose accesses belong to the partition
+
+    @param sim The simulation, with its caches set up
+
+    @return false if the partition is invalid
+*/
+bool parse_partition_config(const string& config, Simulation& sim) {
+    vector<string> parts;
+    size_t pos;
+    size_t lastpos = 0;
+    while ((pos = config.find(",", lastpos)) != string::npos) {
+        parts.push_back(config.substr(lastpos, pos - lastpos));
+        lastpos = pos + 1;
+    }
+    parts.push_back(config.substr(lastpos));
+    if (parts.size() != 5 || (parts[2] != "pc" && parts[2] != "addr"))
+        return false;
+    Cache* c = find_cache(sim, parts[0]);
+    if (c == nullptr || c->assoc > 31)
+        return false;
+    Partition part;
+    unsigned long mask;
+    try {
+        size_t used[3];
+        mask = stoul(parts[1], &used[0], 0);
+        part.lo = stoi(parts[3], &used[1]);
+        part.hi = stoi(parts[4], &used[2]);
+        if (used[0] != parts[1].size() || used[1] != parts[3].size() || used[2] != parts[4].size())
+            return false;
+    } catch (const exception&) {
+        return false;
+    }
+    part.by_pc = parts[2] == "pc";
+    // a partition must own at least one way, and only ways the cache has
+    if (mask == 0 || mask >> c->assoc != 0)
+        return false;
+    part.mask = mask;
+    if (part.lo > part.hi)
+        return false;
+    c->partitions.push_back(part);
+    return true;
+}
+
+
+/*
+    One lw or sw of a recorded trace.
+*/
+struct TraceRecord {
+    unsigned pc;
+    int addr;
+    bool is_store;
+};
+
+// How many records go into one independently decodable chunk of a trace file
+size_t const static TRACE_CHUNK_RECORDS = 1 << 16;
+
+/*
+    What the trace coder remembers about a pc within one chunk, used to
+    predict the next record. A record is predicted when its pc is the one
+    that followed the previous record's pc last time, its address continues
+    the stride of that pc, and it is the same kind of access.
+*/
+struct TracePcState {
+    int last_addr = 0;
+    int stride = 0;
+    bool is_store = false;
+    bool has_next = false;
+    unsigned next_pc = 0;
+};
+
+/*
+    A trace file being written. Records are buffered until a chunk is full.
+*/
+struct TraceWriter {
+    ofstream f;
+    vector<TraceRecord> pending;
+    uint64_t offset = 0;
+    vector<uint64_t> index;  // offset, length and record count of every chunk
+};
+
+/*
+    The chunk index of a trace file opened for reading.
+*/
+struct TraceReader {
+    ifstream f;
+    vector<uint64_t> index;  // offset, length and record count of every chunk
+};
+
+
+void put_varint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(char((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(char(v));
+}
+
+
+bool get_varint(const string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char byte = in[pos++];
+        v |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+
+uint64_t zigzag(int64_t v) {
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+
+
+int64_t unzigzag(uint64_t v) {
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+
+void put_u64(ostream& f, uint64_t v) {
+    for (int byte = 0; byte < 8; byte++)
+        f.put(char((v >> (8 * byte)) & 0xff));
+}
+
+
+uint64_t get_u64(istream& f) {
+    uint64_t v = 0;
+    for (int byte = 0; byte < 8; byte++)
+        v |= uint64_t((unsigned char)f.get()) << (8 * byte);
+    return v;
+}
+
+
+/*
+    Returns whether the trace coder can predict a record entirely from
+    the records before it in the chunk.
+*/
+bool trace_predicted(map<unsigned, TracePcState>& state, bool have_prev, unsigned prev_pc, const TraceRecord& r) {
+    if (!have_prev)
+        return false;
+    map<unsigned, TracePcState>::iterator prev = state.find(prev_pc);
+    map<unsigned, TracePcState>::iterator cur = state.find(r.pc);
+    return prev->second.has_next && prev->second.next_pc == r.pc && cur != state.end() &&
+        cur->second.last_addr + cur->second.stride == r.addr && cur->second.is_store == r.is_store;
+}
+
+
+/*
+    Updates the trace coder's predictions with a record just coded. The
+    encoder and decoder both call this so their predictions stay in step.
+*/
+void trace_update(map<unsigned, TracePcState>& state, bool have_prev, unsigned prev_pc, const TraceRecord& r) {
+    if (have_prev) {
+        state[prev_pc].has_next = true;
+        state[prev_pc].next_pc = r.pc;
+    }
+    map<unsigned, TracePcState>::iterator cur = state.find(r.pc);
+    if (cur == state.end()) {
+        cur = state.insert(make_pair(r.pc, TracePcState())).first;
+        cur->second.last_addr = r.addr;
+    }
+    cur->second.stride = r.addr - cur->second.last_addr;
+    cur->second.last_addr = r.addr;
+    cur->second.is_store = r.is_store;
+}
+
+
+/*
+    Encodes a chunk of trace records. The chunk is a series of varints:
+    an even varint 2n stands for n records that are exactly as predicted
+    (see TracePcState), an odd varint is one literal record holding the
+    zigzag delta of its pc from the previous pc and whether it is a sw,
+    and is followed by the zigzag delta of its address from the predicted
+    address. Predictions start over in every chunk.
+*/
+string encode_trace_chunk(const vector<TraceRecord>& records) {
+    string out;
+    map<unsigned, TracePcState> state;
+    bool have_prev = false;
+    unsigned prev_pc = 0;
+    int prev_addr = 0;
+    uint64_t run = 0;
+    for (const TraceRecord& r : records) {
+        if (trace_predicted(state, have_prev, prev_pc, r)) {
+            run++;
+        }
+        else {
+            if (run > 0) {
+                put_varint(out, run << 1);
+                run = 0;
+            }
+            map<unsigned, TracePcState>::iterator cur = state.find(r.pc);
+            int predicted_addr = cur == state.end() ? prev_addr : cur->second.last_addr + cur->second.stride;
+            put_varint(out, (((zigzag(int64_t(r.pc) - prev_pc) << 1) | r.is_store) << 1) | 1);
+            put_varint(out, zigzag(int64_t(r.addr) - predicted_addr));
+        }
+        trace_update(state, have_prev, prev_pc, r);
+        have_prev = true;
+        prev_pc = r.pc;
+        prev_addr = r.addr;
+    }
+    if (run > 0)
+        put_varint(out, run << 1);
+    return out;
+}
+
+
+/*
+    Decodes a chunk written by encode_trace_chunk.
+
+    @param data The encoded chunk
+
+    @param count How many records the chunk holds
+
+    @param records Filled with the decoded records
+
+    @return false if the chunk is corrupt
+*/
+bool decode_trace_chunk(const string& data, uint64_t count, vector<TraceRecord>& records) {
+    map<unsigned, TracePcState> state;
+    bool have_prev = false;
+    unsigned prev_pc = 0;
+    int prev_addr = 0;
+    size_t pos = 0;
+    records.clear();
+    if (count > TRACE_CHUNK_RECORDS)
+        return false;
+    records.reserve(count);
+    while (records.size() < count) {
+        uint64_t token;
+        if (!get_varint(data, pos, token))
+            return false;
+        uint64_t repeat = (token & 1) ? 1 : token >> 1;
+        if (repeat == 0 || records.size() + repeat > count)
+            return false;
+        for (uint64_t i = 0; i < repeat; i++) {
+            TraceRecord r;
+            if (token & 1) {
+                uint64_t addr_delta;
+                if (!get_varint(data, pos, addr_delta))
+                    return false;
+                r.is_store = (token >> 1) & 1;
+                r.pc = unsigned(prev_pc + unzigzag(token >> 2));
+                map<unsigned, TracePcState>::iterator cur = state.find(r.pc);
+                int predicted_addr = cur == state.end() ? prev_addr : cur->second.last_addr + cur->second.stride;
+                r.addr = int(predicted_addr + unzigzag(addr_delta));
+            }
+            else {
+                if (!have_prev || !state[prev_pc].has_next)
+                    return false;
+                r.pc = state[prev_pc].next_pc;
+                map<unsigned, TracePcState>::iterator cur = state.find(r.pc);
+                if (cur == state.end())
+                    return false;
+                r.addr = cur->second.last_addr + cur->second.stride;
+                r.is_store = cur->second.is_store;
+            }
+            trace_update(state, have_prev, prev_pc, r);
+            have_prev = true;
+            prev_pc = r.pc;
+            prev_addr = r.addr;
+            records.push_back(r);
+        }
+    }
+    return pos == data.size();
+}
+
+
+/*
+    Creates a trace file. The file starts with an 8 byte magic, followed by
+    the encoded chunks, the chunk index and a footer giving the number of
+    chunks and where the index starts, so any chunk can be found and
+    decoded on its own.
+*/
+void open_trace_writer(TraceWriter& w, const string& filename) {
+    w.f.open(filename, ios::binary);
+    if (!w.f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        exit(1);
+    }
+    w.f.write("E20TRC1\n", 8);
+    w.offset = 8;
+}
+
+
+void flush_trace_chunk(TraceWriter& w) {
+    if (w.pending.empty())
+        return;
+    string data = encode_trace_chunk(w.pending);
+    w.f.write(data.data(), data.size());
+    w.index.push_back(w.offset);
+    w.index.push_back(data.size());
+    w.index.push_back(w.pending.size());
+    w.offset += data.size();
+    w.pending.clear();
+}
+
+
+void trace_append(TraceWriter& w, unsigned pc, int addr, bool is_store) {
+    w.pending.push_back(TraceRecord{ pc, addr, is_store });
+    if (w.pending.size() >= TRACE_CHUNK_RECORDS)
+        flush_trace_chunk(w);
+}
+
+
+void close_trace_writer(TraceWriter& w) {
+    flush_trace_chunk(w);
+    for (uint64_t v : w.index)
+        put_u64(w.f, v);
+    put_u64(w.f, w.index.size() / 3);
+    put_u64(w.f, w.offset);
+    w.f.write("E20TIDX\n", 8);
+    w.f.close();
+}
+
+
+/*
+    Opens a trace file and reads its chunk index.
+
+    @return false if the file is not a readable trace, with error set
+*/
+bool open_trace_reader(TraceReader& r, const string& filename, string& error) {
+    r.f.open(filename, ios::binary);
+    char magic[9] = {};
+    r.f.read(magic, 8);
+    if (!r.f || string(magic) != "E20TRC1\n") {
+        error = "Not a trace file: " + filename;
+        return false;
+    }
+    r.f.seekg(0, ios::end);
+    uint64_t size = r.f.tellg();
+    r.f.seekg(-24, ios::end);
+    uint64_t chunks = get_u64(r.f);
+    uint64_t index_offset = get_u64(r.f);
+    r.f.read(magic, 8);
+    // the index must fill the file between the chunks and the footer
+    if (!r.f || string(magic) != "E20TIDX\n" || index_offset < 8 || index_offset > size - 24 ||
+        chunks != (size - 24 - index_offset) / 24 || (size - 24 - index_offset) % 24 != 0) {
+        error = "Corrupt trace file: " + filename;
+        return false;
+    }
+    r.f.seekg(index_offset);
+    r.index.resize(chunks * 3);
+    for (uint64_t& v : r.index)
+        v = get_u64(r.f);
+    if (!r.f) {
+        error = "Corrupt trace file: " + filename;
+        return false;
+    }
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        uint64_t offset = r.index[chunk * 3];
+        uint64_t length = r.index[chunk * 3 + 1];
+        uint64_t count = r.index[chunk * 3 + 2];
+        if (offset < 8 || offset > index_offset || length > index_offset - offset || count == 0 ||
+            count > TRACE_CHUNK_RECORDS) {
+            error = "Corrupt trace file: " + filename;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*
+    Reads the raw bytes of one chunk of a trace file.
+*/
+string read_trace_chunk(TraceReader& r, size_t chunk) {
+    string data(r.index[chunk * 3 + 1], '\0');
+    r.f.seekg(r.index[chunk * 3]);
+    r.f.read(&data[0], data.size());
+    return data;
+}
+
+
+/*
+    Decodes n consecutive chunks of a trace file in parallel, one thread
+    per chunk.
+
+    @param first The first chunk to decode
+
+    @param records Filled with the records of each chunk
+
+    @return false if any of the chunks is corrupt
+*/
+bool decode_trace_batch(TraceReader& r, size_t first, size_t n, vector<vector<TraceRecord>>& records) {
+    vector<string> data(n);
+    vector<char> ok(n);
+    records.assign(n, vector<TraceRecord>());
+    for (size_t i = 0; i < n; i++)
+        data[i] = read_trace_chunk(r, first + i);
+    vector<thread> workers;
+    for (size_t i = 0; i < n; i++) {
+        workers.emplace_back([&, i]() {
+            ok[i] = decode_trace_chunk(data[i], r.index[(first + i) * 3 + 2], records[i]);
+        });
+    }
+    for (thread& t : workers)
+        t.join();
+    return find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+
+/*
+    Reads a whole trace file into memory.
+
+    @return false if the file is not a readable trace, with error set
+*/
+bool read_trace(const string& filename, vector<TraceRecord>& out, string& error) {
+    TraceReader r;
+    if (!open_trace_reader(r, filename, error))
+        return false;
+    size_t chunks = r.index.size() / 3;
+    size_t batch = max(1u, thread::hardware_concurrency());
+    out.clear();
+    for (size_t first = 0; first < chunks; first += batch) {
+        vector<vector<TraceRecord>> records;
+        if (!decode_trace_batch(r, first, min(batch, chunks - first), records)) {
+            error = "Corrupt trace file: " + filename;
+            return false;
+        }
+        for (const vector<TraceRecord>& chunk : records)
+            out.insert(out.end(), chunk.begin(), chunk.end());
+    }
+    return true;
+}
+
+
+/*
+    Streams the records of a trace file, in order, to visit. Chunks are
+    decoded in parallel, a batch of one chunk per hardware thread at a
+    time, so only one batch is in memory at once.
+*/
+void scan_trace(const string& filename, const function<void(const TraceRecord&)>& visit) {
+    TraceReader r;
+    string error;
+    if (!open_trace_reader(r, filename, error)) {
+        cerr << error << endl;
+        exit(1);
+    }
+    size_t chunks = r.index.size() / 3;
+    size_t batch = max(1u, thread::hardware_concurrency());
+    for (size_t first = 0; first < chunks; first += batch) {
+        vector<vector<TraceRecord>> records;
+        if (!decode_trace_batch(r, first, min(batch, chunks - first), records)) {
+            cerr << "Corrupt trace file: " << filename << endl;
+            exit(1);
+        }
+        for (const vector<TraceRecord>& chunk : records)
+            for (const TraceRecord& rec : chunk)
+                visit(rec);
+    }
+}
+
+
+/*
+    Replays a trace file through the caches as if the program that
+    recorded it were running.
+
+    @param log Whether to print the log entries of the accesses
+*/
+void replay_trace(const string& filename, vector<Cache>& caches, bool log) {
+    scan_trace(filename, [&](const TraceRecord& rec) {
+        simulate_access(caches, rec.is_store, rec.pc, rec.addr, log);
+    });
+}
+
+
+/*
+    Executes up to count instructions without simulating the caches.
+
+    @return The number of instructions executed. Less than count if the program halted
+*/
+uint64_t fast_forward(Machine& m, uint64_t count) {
+    ExecInfo info;
+    uint64_t executed = 0;
+    while (executed < count && execute_instruction(m, info)) {
+        executed++;
+    }
+    return executed;
+}
+
+
+/*
+    Executes up to count instructions without simulating the caches,
+    passing every lw and sw made to visit.
+
+    @return The number of instructions executed. Less than count if the program halted
+*/
+uint64_t scan_accesses(Machine& m, uint64_t count, const function<void(const TraceRecord&)>& visit) {
+    ExecInfo info;
+    uint64_t executed = 0;
+    while (executed < count && execute_instruction(m, info)) {
+        if (info.is_load || info.is_store)
+            visit(TraceRecord{ info.pc, info.addr, info.is_store });
+        executed++;
+    }
+    return executed;
+}
+
+
+/*
+    Executes up to count instructions without simulating the caches,
+    recording every lw and sw made.
+
+    @param accesses The accesses are appended here
+
+    @return The number of instructions executed. Less than count if the program halted
+*/
+uint64_t record_accesses(Machine& m, uint64_t count, vector<TraceRecord>& accesses) {
+    return scan_accesses(m, count, [&](const TraceRecord& r) { accesses.push_back(r); });
+}
+
+
+/*
+    Executes up to count instructions, simulating every lw and sw against
+    the caches, and every instruction fetch when there is an instruction
+    cache.
+
+    @param log Whether to print the log entries of the accesses
+
+    @param trace If not null, every lw and sw is also recorded here
+
+    @return The number of instructions executed. Less than count if the program halted
+*/
+uint64_t simulate(Machine& m, Simulation& sim, uint64_t count, bool log, TraceWriter* trace = nullptr) {
+    ExecInfo info;
+    uint64_t executed = 0;
+    bool fetches = sim.icache.numlines > 0;
+    while (executed < count && execute_instruction(m, info)) {
+        int fetch_level = 0;
+        int data_level = 0;
+        bool redirect = false;
+        uint64_t translate = 0;
+        if (fetches)
+            fetch_level = simulate_fetch(sim, info.pc, log);
+        if (sim.branches.enabled && info.branch != BRANCH_NONE)
+            redirect = predict_branch(sim.branches, info);
+        else if (info.branch != BRANCH_NONE)
+            redirect = info.next_pc != ((info.pc + 1) & (MEM_SIZE - 1));
+        if (info.is_load || info.is_store) {
+            if (sim.tlb.enabled)
+                translate = simulate_translation(sim, info.pc, info.addr, log);
+            data_level = simulate_access(sim.caches, info.is_store, info.pc, info.addr, log);
+            if (data_level == int(sim.caches.size()))
+                data_level = 2; // memory
+            if (trace != nullptr)
+                trace_append(*trace, info.pc, info.addr, info.is_store);
+        }
+        if (sim.pipeline.enabled)
+            pipeline_step(sim.pipeline, info, fetch_level, data_level, redirect, translate);
+        executed++;
+    }
+    return executed;
+}
+
+
+/*
+    Writes the tags and LRU order of every line of a cache that holds a tag
+    to a checkpoint.
+*/
+void write_checkpoint_cache(ofstream& f, const Cache& c) {
+    f << "cache " << c.name << " " << c.size << " " << c.assoc << " " << c.blocksize << endl;
+    vector<int> lines = c.slot_line;
+    sort(lines.begin(), lines.end());
+    for (int line : lines) {
+        const int* ways = &c.arena[line_slot(c, line) * (2 * c.assoc + 1)];
+        const int* order = ways + c.assoc;
+        f << "line " << line;
+        for (int way = 0; way < c.assoc; way++)
+            f << " " << ways[way];
+        f << " " << order[c.assoc];
+        for (int i = 0; i < order[c.assoc]; i++)
+            f << " " << order[i];
+        f << endl;
+    }
+    f << "end" << endl;
+}
+
+
+/*
+    Writes a checkpoint of the machine and caches to a file. The checkpoint
+    is plain text: the instruction count, pc, registers, the nonzero words
+    of memory and the tags and LRU order of every line that holds a tag.
+
+    @param filename The file to write
+
+    @param m The machine state
+
+    @param sim The cache state
+
+    @param executed How many instructions have been executed so far
+*/
+void save_checkpoint(const string& filename, const Machine& m, const Simulation& sim, uint64_t executed) {
+    ofstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        exit(1);
+    }
+    f << "E20-checkpoint 1" << endl;
+    f << "instructions " << executed << endl;
+    f << "pc " << m.PC << endl;
+    f << "registers";
+    for (size_t reg = 0; reg < NUM_REGS; reg++)
+        f << " " << m.registers[reg];
+    f << endl;
+
+    size_t nonzero = 0;
+    for (size_t addr = 0; addr < MEM_SIZE; addr++)
+        if (m.memory[addr] != 0)
+            nonzero++;
+    f << "memory " << nonzero << endl;
+    for (size_t addr = 0; addr < MEM_SIZE; addr++)
+        if (m.memory[addr] != 0)
+            f << addr << " " << m.memory[addr] << endl;
+
+    f << "caches " << sim.caches.size() << endl;
+    for (const Cache& c : sim.caches)
+        write_checkpoint_cache(f, c);
+    f << "icache " << (sim.icache.numlines > 0 ? 1 : 0) << endl;
+    if (sim.icache.numlines > 0)
+        write_checkpoint_cache(f, sim.icache);
+}
+
+
+/*
+    Reads the lines of one cache written by write_checkpoint_cache into
+    the cache, which must be configured the same way.
+*/
+void read_checkpoint_cache(ifstream& f, Cache& c, const string& filename) {
+    string word, name;
+    int size, assoc, blocksize;
+    f >> word >> name >> size >> assoc >> blocksize;
+    if (name != c.name || size != c.size || assoc != c.assoc || blocksize != c.blocksize) {
+        cerr << "Checkpoint cache configuration does not match --cache" << endl;
+        exit(1);
+    }
+    while (f >> word && word == "line") {
+        int line;
+        size_t used;
+        f >> line;
+        // negative addresses use the lines -numlines+1 to -1 as well
+        if (line <= -c.numlines || line >= c.numlines || !line_sampled(c, line)) {
+            cerr << "Corrupt checkpoint file: " << filename << endl;
+            exit(1);
+        }
+        int* ways = touch_line(c, line);
+        int* order = ways + c.assoc;
+        for (int way = 0; way < c.assoc; way++)
+            f >> ways[way];
+        f >> used;
+        if (used > size_t(c.assoc)) {
+            cerr << "Corrupt checkpoint file: " << filename << endl;
+            exit(1);
+        }
+        order[c.assoc] = used;
+        for (size_t i = 0; i < used; i++)
+            f >> order[i];
+        if (c.sector_size > 0) { // sectors are not checkpointed, the blocks come back whole and clean
+            size_t first = line_slot(c, line) * c.assoc;
+            int sectors = c.blocksize / c.sector_size;
+            for (int way = 0; way < c.assoc; way++)
+                if (ways[way] != -1)
+                    c.sector_valid[first + way] = sectors == 32 ? ~0u : (1u << sectors) - 1;
+        }
+    }
+}
+
+
+/*
+    Restores the machine and caches from a checkpoint written by
+    save_checkpoint. The caches must already be configured the same way
+    as when the checkpoint was written, unless the checkpoint holds no
+    cache state, in which case they are left cold. Checkpoints written
+    before instruction caches were simulated leave the instruction cache
+    cold too.
+
+    @param filename The file to read
+
+    @param m The machine to restore
+
+    @param sim The configured caches to restore
+
+    @return The instruction count stored in the checkpoint
+*/
+uint64_t load_checkpoint(const string& filename, Machine& m, Simulation& sim) {
+    ifstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        exit(1);
+    }
+    string word;
+    int version;
+    uint64_t executed;
+    size_t count;
+    f >> word >> version;
+    if (word != "E20-checkpoint" || version != 1) {
+        cerr << "Not a checkpoint file: " << filename << endl;
+        exit(1);
+    }
+    f >> word >> executed >> word >> m.PC >> word;
+    for (size_t reg = 0; reg < NUM_REGS; reg++)
+        f >> m.registers[reg];
+
+    f >> word >> count;
+    fill(m.memory, m.memory + MEM_SIZE, 0);
+    for (size_t i = 0; i < count; i++) {
+        size_t addr;
+        f >> addr;
+        if (addr >= MEM_SIZE) {
+            cerr << "Corrupt checkpoint file: " << filename << endl;
+            exit(1);
+        }
+        f >> m.memory[addr];
+    }
+
+    f >> word >> count;
+    if (count != 0 && count != sim.caches.size()) {
+        cerr << "Checkpoint cache configuration does not match --cache" << endl;
+        exit(1);
+    }
+    for (size_t level = 0; level < count; level++)
+        read_checkpoint_cache(f, sim.caches[level], filename);
+    if (!f) {
+        cerr << "Corrupt checkpoint file: " << filename << endl;
+        exit(1);
+    }
+
+    if (f >> word) {
+        f >> count;
+        if (word != "icache" || count > 1) {
+            cerr << "Corrupt checkpoint file: " << filename << endl;
+            exit(1);
+        }
+        if (count != 0 && sim.icache.numlines == 0) {
+            cerr << "Checkpoint cache configuration does not match --icache" << endl;
+            exit(1);
+        }
+        if (count != 0)
+            read_checkpoint_cache(f, sim.icache, filename);
+        if (!f) {
+            cerr << "Corrupt checkpoint file: " << filename << endl;
+            exit(1);
+        }
+    }
+    sim.last_fetch_block = -1;
+    return executed;
+}
+
+
+/*
+    Runs the program in SMARTS-style sampled mode. Every period instructions
+    the caches are warmed for warmup instructions and then measured for
+    detail instructions; everything in between is fast-forwarded without
+    simulating the caches. Prints the estimated miss rate of each cache level
+    together with its 95% confidence interval.
+
+    @param limit The most instructions to execute
+
+    @return The number of instructions executed
+*/
+uint64_t simulate_sampled(Machine& m, Simulation& sim, uint64_t period, uint64_t detail, uint64_t warmup, uint64_t limit) {
+    const vector<Cache>& caches = sim.caches;
+    vector<vector<double>> window_rates(caches.size()); // miss rate of every measured window, per level
+    vector<uint64_t> sampled_hits(caches.size(), 0);
+    vector<uint64_t> sampled_misses(caches.size(), 0);
+    uint64_t executed = 0;
+    uint64_t windows = 0;
+    bool halted = false;
+
+    while (!halted && executed < limit) {
+        uint64_t skip = min(period - warmup - detail, limit - executed);
+        uint64_t done = fast_forward(m, skip);
+        executed += done;
+        if (done < skip || executed >= limit)
+            break;
+
+        uint64_t warm = min(warmup, limit - executed);
+        done = simulate(m, sim, warm, false);
+        executed += done;
+        if (done < warm || executed >= limit)
+            break;
+
+        vector<uint64_t> hits_before, misses_before;
+        for (const Cache& c : caches) {
+            hits_before.push_back(c.hits);
+            misses_before.push_back(c.misses);
+        }
+        uint64_t measure = min(detail, limit - executed);
+        done = simulate(m, sim, measure, false);
+        executed += done;
+        halted = done < measure;
+        windows++;
+
+        for (size_t level = 0; level < caches.size(); level++) {
+            uint64_t hits = caches[level].hits - hits_before[level];
+            uint64_t misses = caches[level].misses - misses_before[level];
+            sampled_hits[level] += hits;
+            sampled_misses[level] += misses;
+            if (hits + misses > 0)
+                window_rates[level].push_back(double(misses) / (hits + misses));
+        }
+    }
+
+    cout << "Sampled " << windows << " windows of " << detail << " instructions (warmup " << warmup <<
+        ") every " << period << " instructions, " << executed << " instructions executed" << endl;
+    for (size_t level = 0; level < caches.size(); level++) {
+        const vector<double>& rates = window_rates[level];
+        cout << "Cache " << caches[level].name << " sampled " << sampled_hits[level] + sampled_misses[level] <<
+            " lw accesses, estimated miss rate ";
+        if (rates.empty()) {
+            cout << "n/a" << endl;
+            continue;
+        }
+        double mean = 0;
+        for (double r : rates)
+            mean += r;
+        mean /= rates.size();
+        cout << fixed << setprecision(4) << mean;
+        if (rates.size() > 1) {
+            double var = 0;
+            for (double r : rates)
+                var += (r - mean) * (r - mean);
+            var /= rates.size() - 1;
+            cout << " +/- " << 1.96 * sqrt(var / rates.size()) << " (95% confidence, " << rates.size() << " windows)";
+        }
+        cout << defaultfloat << endl;
+    }
+    return executed;
+}
+
+
+/*
+    Prints the estimates of a set-sampled cache. The miss rate is the ratio
+    of sampled misses to sampled lw accesses; its confidence interval treats
+    each sampled line as one observation of a ratio estimator. Totals are
+    the sampled counts scaled up by the fraction of lines sampled.
+*/
+void print_set_sample_summary(const Cache& c) {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    for (size_t slot = 0; slot < c.slot_line.size(); slot++) {
+        hits += c.slot_hits[slot];
+        misses += c.slot_misses[slot];
+    }
+    double scale = double(c.numlines) / c.sampled_lines;
+    cout << "Cache " << c.name << " set sampling simulated " << c.sampled_lines << " of " << c.numlines <<
+        " lines, " << hits + misses << " lw accesses sampled" << endl;
+    cout << "Cache " << c.name << " estimated lw accesses " << uint64_t((hits + misses) * scale + 0.5) <<
+        ", misses " << uint64_t(misses * scale + 0.5) << ", miss rate ";
+    if (hits + misses == 0) {
+        cout << "n/a" << endl;
+        return;
+    }
+    double n = c.sampled_lines;
+    double rate = double(misses) / (hits + misses);
+    cout << fixed << setprecision(4) << rate;
+    if (c.sampled_lines > 1) {
+        double mean_accesses = (hits + misses) / n;
+        double sum_sq = 0; // sampled lines that were never touched add nothing
+        for (size_t slot = 0; slot < c.slot_line.size(); slot++) {
+            double accesses = c.slot_hits[slot] + c.slot_misses[slot];
+            double d = c.slot_misses[slot] - rate * accesses;
+            sum_sq += d * d;
+        }
+        double var = sum_sq / (n * (n - 1) * mean_accesses * mean_accesses);
+        cout << " +/- " << 1.96 * sqrt(var) << " (95% confidence)";
+    }
+    cout << defaultfloat << endl;
+}
+
+
+// The associativities and blocksizes --search chooses from
+int const static SEARCH_ASSOCS[] = { 1, 2, 4, 8, 16 };
+int const static SEARCH_BLOCKSIZES[] = { 1, 2, 4, 8, 16, 32, 64 };
+int const static MAX_STACK_DEPTH = 16;
+
+/*
+    One cache configuration evaluated by --search.
+*/
+struct SearchCandidate {
+    int blocksize;
+    int numlines;
+    int assoc;
+    int size;
+    uint64_t misses;  // lw misses
+};
+
+
+/*
+    Finds, for every access, how far down the LRU stack of its line its
+    block was: 0 for the most recently used block of the line. Blocks not
+    among the MAX_STACK_DEPTH most recent are given MAX_STACK_DEPTH. An
+    access hits a cache with this blocksize and number of lines exactly
+    when its depth is less than the associativity, so one pass serves
+    every associativity.
+
+    @param accesses The lw and sw accesses, in program order
+
+    @return The depth of each access
+*/
+vector<unsigned char> stack_depths(const vector<TraceRecord>& accesses, int blocksize, int numlines) {
+    vector<unsigned char> depths(accesses.size());
+    map<int, vector<int>> stacks; // the blocks of each touched line, most recently used first
+    for (size_t i = 0; i < accesses.size(); i++) {
+        int blockID = accesses[i].addr / blocksize;
+        vector<int>& stack = stacks[blockID % numlines];
+        vector<int>::iterator found = find(stack.begin(), stack.end(), blockID);
+        if (found == stack.end()) {
+            depths[i] = MAX_STACK_DEPTH;
+            if (stack.size() == MAX_STACK_DEPTH)
+                stack.pop_back();
+            stack.insert(stack.begin(), blockID);
+        }
+        else {
+            depths[i] = found - stack.begin();
+            rotate(stack.begin(), found, found + 1);
+        }
+    }
+    return depths;
+}
+
+
+/*
+    Evaluates every single cache with the given blocksize and number of
+    lines that fits in the budget, from one pass of stack depths.
+
+    @param out Each configuration is appended here, with its lw misses
+*/
+void evaluate_candidates(const vector<TraceRecord>& accesses, int blocksize, int numlines, int budget,
+    vector<SearchCandidate>& out) {
+    vector<unsigned char> depths = stack_depths(accesses, blocksize, numlines);
+    uint64_t hist[MAX_STACK_DEPTH + 1] = {};
+    for (size_t i = 0; i < accesses.size(); i++)
+        if (!accesses[i].is_store)
+            hist[depths[i]]++;
+    for (int assoc : SEARCH_ASSOCS) {
+        int64_t size = int64_t(blocksize) * numlines * assoc;
+        if (size > budget)
+            break;
+        uint64_t misses = 0;
+        for (int d = assoc; d <= MAX_STACK_DEPTH; d++)
+            misses += hist[d];
+        out.push_back(SearchCandidate{ blocksize, numlines, assoc, int(size), misses });
+    }
+}
+
+
+/*
+    Reads a --latency configuration.
+
+    @param config L1,L2,MEM cycles, each at least 0 and no less than the one before
+
+    @param latency Set to the three latencies
+
+    @return false if the configuration is invalid
+*/
+bool parse_latency_config(const string& config, vector<double>& latency) {
+    latency.clear();
+    size_t pos;
+    size_t lastpos = 0;
+    try {
+        while (true) {
+            pos = config.find(",", lastpos);
+            string part = config.substr(lastpos, pos == string::npos ? string::npos : pos - lastpos);
+            size_t used = 0;
+            latency.push_back(stod(part, &used));
+            if (used != part.size())
+                return false;
+            if (pos == string::npos)
+                break;
+            lastpos = pos + 1;
+        }
+    } catch (const exception&) {
+        return false;
+    }
+    return latency.size() == 3 && latency[0] >= 0 && latency[1] >= latency[0] && latency[2] >= latency[1];
+}
+
+
+/*
+    Searches L1 and L1+L2 configurations whose total size fits in budget
+    for the lowest average lw latency, and prints the Pareto front of
+    total size against latency.
+
+    Every blocksize and number of lines takes one stack depth pass,
+    which prices all associativities at once. Two-level hierarchies only
+    use L1 configurations on the L1-only front of size against misses
+    (the others are dominated as a first level too), and their L2 is
+    searched the same way over the L1's miss stream. Stores update both
+    levels but only lw latency is counted.
+
+    @param accesses The lw and sw accesses, in program order
+
+    @param budget The largest total size, in memory cells, of all levels
+
+    @param latency Cycles for an L1 hit, an L2 hit and a memory access
+*/
+void run_search(const vector<TraceRecord>& accesses, int budget, const vector<double>& latency) {
+    uint64_t loads = 0;
+    for (const TraceRecord& r : accesses)
+        if (!r.is_store)
+            loads++;
+
+    vector<SearchCandidate> l1;
+    for (int blocksize : SEARCH_BLOCKSIZES)
+        for (int numlines = 1; int64_t(blocksize) * numlines <= budget; numlines *= 2)
+            evaluate_candidates(accesses, blocksize, numlines, budget, l1);
+
+    // (total size, latency per lw, --cache string) of every hierarchy evaluated
+    vector<pair<pair<int, double>, string>> results;
+    for (const SearchCandidate& c : l1) {
+        double cycles = loads * latency[0] + c.misses * latency[2];
+        results.push_back(make_pair(make_pair(c.size, loads ? cycles / loads : 0),
+            to_string(c.size) + "," + to_string(c.assoc) + "," + to_string(c.blocksize)));
+    }
+
+    vector<SearchCandidate> front = l1;
+    sort(front.begin(), front.end(), [](const SearchCandidate& a, const SearchCandidate& b) {
+        return a.size != b.size ? a.size < b.size : a.misses < b.misses;
+    });
+    size_t kept = 0;
+    for (size_t i = 0; i < front.size(); i++)
+        if (kept == 0 || front[i].misses < front[kept - 1].misses)
+            front[kept++] = front[i];
+    front.resize(kept);
+
+    for (const SearchCandidate& c1 : front) {
+        if (int64_t(c1.size) * 2 >= budget) // an L2 must be bigger than its L1
+            continue;
+        vector<unsigned char> depths = stack_depths(accesses, c1.blocksize, c1.numlines);
+        vector<TraceRecord> misses;
+        for (size_t i = 0; i < accesses.size(); i++)
+            if (depths[i] >= c1.assoc)
+                misses.push_back(accesses[i]);
+        string l1_config = to_string(c1.size) + "," + to_string(c1.assoc) + "," + to_string(c1.blocksize);
+        for (int blocksize : SEARCH_BLOCKSIZES) {
+            if (blocksize < c1.blocksize)
+                continue;
+            for (int numlines = 1; int64_t(blocksize) * numlines <= budget - c1.size; numlines *= 2) {
+                vector<SearchCandidate> l2;
+                evaluate_candidates(misses, blocksize, numlines, budget - c1.size, l2);
+                for (const SearchCandidate& c2 : l2) {
+                    if (c2.size <= c1.size)
+                        continue;
+                    double cycles = loads * latency[0] + c1.misses * latency[1] + c2.misses * latency[2];
+                    results.push_back(make_pair(make_pair(c1.size + c2.size, loads ? cycles / loads : 0),
+                        l1_config + "," + to_string(c2.size) + "," + to_string(c2.assoc) + "," + to_string(c2.blocksize)));
+                }
+            }
+        }
+    }
+
+    sort(results.begin(), results.end());
+    cout << "Searched " << results.size() << " configurations within size " << budget << " (" << l1.size() - front.size() <<
+        " L1 configurations pruned as first levels), latency L1 " << latency[0] << ", L2 " << latency[1] <<
+        ", memory " << latency[2] << endl;
+    cout << "Pareto front of " << loads << " lw accesses:" << endl;
+    cout << "   size  avg lw latency  cache" << endl;
+    double best = -1;
+    for (const pair<pair<int, double>, string>& r : results) {
+        if (best >= 0 && r.first.second >= best)
+            continue;
+        best = r.first.second;
+        cout << setw(7) << r.first.first << "  " << fixed << setprecision(4) << setw(14) << r.first.second <<
+            defaultfloat << "  " << r.second << endl;
+    }
+}
+
+
+// SHARDS samples a block when its hash modulo this is below the threshold
+uint64_t const static SHARDS_MODULUS = 1 << 24;
+
+/*
+    State of a SHARDS (spatially hashed approximate reuse distance)
+    analysis. A block is sampled when the hash of its block number is
+    below a threshold, so every reference to a sampled block is seen and
+    its reuse distance among sampled blocks, scaled up by the sampling
+    rate, estimates the true reuse distance.
+
+    In fixed-rate mode the threshold never changes. In fixed-size mode at
+    most max_blocks blocks are tracked: when another would be added, the
+    tracked block with the largest hash is dropped and the threshold
+    lowered to its hash, and the histogram is scaled down to match the
+    lower rate. Memory then stays bounded however long the trace is.
+
+    Reuse distances among the tracked blocks are counted with a Fenwick
+    tree over access times, in which only the latest access of each block
+    is marked; the tree is compacted when it runs out of times.
+*/
+struct Shards {
+    bool fixed_size = false;
+    size_t max_blocks = 0;
+    int blocksize = 1;
+    uint64_t threshold = SHARDS_MODULUS;
+    unordered_map<int, uint64_t> last_time;   // tracked block -> time of its latest access
+    set<pair<uint64_t, int>> by_hash;         // tracked blocks by hash, fixed-size mode only
+    vector<int64_t> tree;                     // Fenwick tree over times 1..tree.size()-1
+    uint64_t now = 0;
+    vector<double> hist;                      // sampled references by reuse distance bucket
+    double cold = 0;                          // sampled references to blocks not seen before
+    uint64_t references = 0;
+    uint64_t sampled = 0;
+};
+
+
+/*
+    Reads a --shards configuration.
+
+    @param config rate,R[,BLOCKSIZE] with 0 < R <= 1, or size,N[,BLOCKSIZE]
+
+    @param s Set to fixed-rate or fixed-size mode and the blocksize
+
+    @return false if the configuration is invalid
+*/
+bool parse_shards_config(const string& config, Shards& s) {
+    size_t comma = config.find(",");
+    if (comma == string::npos)
+        return false;
+    string mode = config.substr(0, comma);
+    string value = config.substr(comma + 1);
+    size_t blocksize_comma = value.find(",");
+    if (blocksize_comma != string::npos) {
+        if (!parse_int_arg(value.substr(blocksize_comma + 1), 1, s.blocksize))
+            return false;
+        value = value.substr(0, blocksize_comma);
+    }
+    if (mode == "size") {
+        int blocks;
+        if (!parse_int_arg(value, 1, blocks))
+            return false;
+        s.fixed_size = true;
+        s.max_blocks = blocks;
+        return true;
+    }
+    if (mode != "rate")
+        return false;
+    size_t used = 0;
+    double rate;
+    try {
+        rate = stod(value, &used);
+    } catch (const exception&) {
+        return false;
+    }
+    if (used != value.size() || !(rate > 0 && rate <= 1))
+        return false;
+    s.threshold = max<uint64_t>(1, uint64_t(rate * SHARDS_MODULUS));
+    return true;
+}
+
+
+uint64_t shards_hash(int blockID) {
+    uint64_t h = uint32_t(blockID);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h % SHARDS_MODULUS;
+}
+
+
+void fenwick_add(vector<int64_t>& tree, uint64_t pos, int64_t delta) {
+    for (; pos < tree.size(); pos += pos & (~pos + 1))
+        tree[pos] += delta;
+}
+
+
+int64_t fenwick_sum(const vector<int64_t>& tree, uint64_t pos) {
+    int64_t sum = 0;
+    for (; pos > 0; pos -= pos & (~pos + 1))
+        sum += tree[pos];
+    return sum;
+}
+
+
+/*
+    Renumbers the latest access times of the tracked blocks 1..n, keeping
+    their order, and rebuilds the Fenwick tree with room to spare.
+*/
+void shards_compact(Shards& s) {
+    vector<pair<uint64_t, int>> order;
+    for (const pair<const int, uint64_t>& entry : s.last_time)
+        order.push_back(make_pair(entry.second, entry.first));
+    sort(order.begin(), order.end());
+    s.tree.assign(max<size_t>(1024, 2 * order.size() + 1), 0);
+    s.now = 0;
+    for (const pair<uint64_t, int>& entry : order) {
+        s.last_time[entry.second] = ++s.now;
+        fenwick_add(s.tree, s.now, 1);
+    }
+}
+
+
+/*
+    Returns the histogram bucket of a reuse distance: 0 for distance 0
+    and k for distances in [2^(k-1), 2^k).
+*/
+size_t shards_bucket(double distance) {
+    size_t bucket = 0;
+    while (distance >= 1) {
+        distance /= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+/*
+    Feeds one memory reference to a SHARDS analysis.
+*/
+void shards_access(Shards& s, int addr) {
+    s.references++;
+    int blockID = addr / s.blocksize;
+    uint64_t h = shards_hash(blockID);
+    if (h >= s.threshold)
+        return;
+    s.sampled++;
+    double rate = double(s.threshold) / SHARDS_MODULUS;
+
+    unordered_map<int, uint64_t>::iterator found = s.last_time.find(blockID);
+    if (found != s.last_time.end()) {
+        int64_t distance = fenwick_sum(s.tree, s.now) - fenwick_sum(s.tree, found->second);
+        size_t bucket = shards_bucket(distance / rate);
+        if (bucket >= s.hist.size())
+            s.hist.resize(bucket + 1, 0);
+        s.hist[bucket]++;
+        fenwick_add(s.tree, found->second, -1);
+    }
+    else {
+        s.cold++;
+        if (s.fixed_size) {
+            s.by_hash.insert(make_pair(h, blockID));
+            if (s.by_hash.size() > s.max_blocks) { // drop the largest hash and lower the rate to exclude it
+                set<pair<uint64_t, int>>::iterator largest = prev(s.by_hash.end());
+                double scale = double(largest->first) / s.threshold;
+                s.threshold = largest->first;
+                for (double& count : s.hist)
+                    count *= scale;
+                s.cold *= scale;
+                unordered_map<int, uint64_t>::iterator evicted = s.last_time.find(largest->second);
+                if (evicted != s.last_time.end()) {
+                    fenwick_add(s.tree, evicted->second, -1);
+                    s.last_time.erase(evicted);
+                }
+                bool self = largest->second == blockID;
+                s.by_hash.erase(largest);
+                if (self)
+                    return;
+            }
+        }
+    }
+
+    if (s.now + 1 >= s.tree.size())
+        shards_compact(s);
+    s.last_time[blockID] = ++s.now;
+    fenwick_add(s.tree, s.now, 1);
+}
+
+
+/*
+    Prints the estimated reuse distance histogram and miss ratio curve of
+    a SHARDS analysis. A fully associative LRU cache of C blocks misses on
+    every reference whose reuse distance is C or more.
+*/
+void print_shards(const Shards& s) {
+    double rate = double(s.threshold) / SHARDS_MODULUS;
+    cout << "SHARDS " << (s.fixed_size ? "fixed-size" : "fixed-rate") << " sampling, blocksize " << s.blocksize <<
+        ": " << s.sampled << " of " << s.references << " references sampled, final rate " << rate << ", " <<
+        s.last_time.size() << " blocks tracked" << endl;
+    double total = s.cold;
+    for (double count : s.hist)
+        total += count;
+    if (total == 0)
+        return;
+
+    cout << "Reuse distance histogram (distance in blocks, estimated references):" << endl;
+    cout << "  " << left << setw(20) << "cold" << right << fixed << setprecision(0) << s.cold / rate << endl;
+    for (size_t bucket = 0; bucket < s.hist.size(); bucket++) {
+        string range = bucket == 0 ? "0" : bucket == 1 ? "1" :
+            to_string(1ULL << (bucket - 1)) + "-" + to_string((1ULL << bucket) - 1);
+        cout << "  " << left << setw(20) << range << right << s.hist[bucket] / rate << endl;
+    }
+
+    cout << "Miss ratio curve (cache size in memory cells, miss ratio):" << endl;
+    if (s.hist.empty())
+        cout << "  " << setw(12) << "any" << "  " << setprecision(4) << 1.0 << endl;
+    double misses = total;
+    for (size_t bucket = 0; bucket < s.hist.size(); bucket++) {
+        // a cache of 2^bucket blocks hits every reuse distance below 2^bucket: this bucket and all lower ones
+        misses -= s.hist[bucket];
+        cout << "  " << setw(12) << (1ULL << bucket) * s.blocksize << "  " << setprecision(4) << misses / total << endl;
+    }
+    cout << defaultfloat;
+}
+
+
+/*
+    A program or trace kept in memory by --serve. Cache contents never
+    change what a program does, so its lw and sw accesses are recorded
+    once and replayed for every cache configuration asked about.
+*/
+struct ServedProgram {
+    uint64_t instructions = 0;  // instructions executed while recording, 0 for a loaded trace
+    vector<TraceRecord> accesses;
+};
+
+
+/*
+    Handles one line of the --serve protocol:
+
+        load NAME FILE [MAX_INSTS]  run machine code once and keep its accesses
+        trace NAME FILE             keep the accesses of a --trace-save file
+        run NAME CACHE...           simulate the kept accesses under each --cache
+                                    configuration, one "result" line each
+        drop NAME                   forget a program
+        list                        one "program" line per kept program
+        quit                        end the session
+
+    Every response ends with a line that is "ok" or starts with "error".
+
+    @param programs The programs kept so far
+
+    @param request The request line
+
+    @param max_insts The instruction limit of a load without MAX_INSTS
+
+    @param quit Set when the client asks to end the session
+
+    @return The response, one or more newline-terminated lines
+*/
+string serve_request(map<string, ServedProgram>& programs, const string& request, uint64_t max_insts, bool& quit) {
+    istringstream in(request);
+    ostringstream out;
+    string command, name;
+    in >> command;
+    try {
+        if (command.empty()) {
+            return "";
+        }
+        else if (command == "load" || command == "trace") {
+            string file;
+            if (!(in >> name >> file))
+                return "error usage: " + command + " NAME FILE\n";
+            ServedProgram program;
+            string error;
+            if (command == "load") {
+                string limit;
+                if ((in >> limit) && !parse_count_arg(limit, max_insts))
+                    return "error Invalid instruction limit " + limit + "\n";
+                ifstream f(file);
+                if (!f.is_open())
+                    return "error Can't open file " + file + "\n";
+                Machine* machine = new Machine();
+                bool ok = parse_machine_code(f, machine->memory, error);
+                if (ok)
+                    program.instructions = record_accesses(*machine, max_insts, program.accesses);
+                delete machine;
+                if (!ok)
+                    return "error " + error + "\n";
+            }
+            else if (!read_trace(file, program.accesses, error)) {
+                return "error " + error + "\n";
+            }
+            programs[name] = move(program);
+            out << "ok " << name << " instructions " << programs[name].instructions <<
+                " accesses " << programs[name].accesses.size() << endl;
+        }
+        else if (command == "run") {
+            if (!(in >> name))
+                return "error usage: run NAME CACHE...\n";
+            map<string, ServedProgram>::iterator program = programs.find(name);
+            if (program == programs.end())
+                return "error No program named " + name + "\n";
+            string config;
+            while (in >> config) {
+                vector<Cache> caches;
+                if (!parse_cache_config(config, caches, 1))
+                    return out.str() + "error Invalid cache config " + config + "\n";
+                for (const TraceRecord& r : program->second.accesses)
+                    simulate_access(caches, r.is_store, r.pc, r.addr, false);
+                out << "result " << config << " instructions " << program->second.instructions;
+                for (const Cache& c : caches)
+                    out << " " << c.name << " hits " << c.hits << " misses " << c.misses << " stores " << c.stores;
+                out << endl;
+            }
+            out << "ok" << endl;
+        }
+        else if (command == "drop") {
+            if (!(in >> name) || programs.erase(name) == 0)
+                return "error No program named " + name + "\n";
+            out << "ok" << endl;
+        }
+        else if (command == "list") {
+            for (const pair<const string, ServedProgram>& p : programs)
+                out << "program " << p.first << " instructions " << p.second.instructions <<
+                    " accesses " << p.second.accesses.size() << endl;
+            out << "ok" << endl;
+        }
+        else if (command == "quit") {
+            quit = true;
+            out << "ok" << endl;
+        }
+        else {
+            out << "error Unknown request " << command << endl;
+        }
+    }
+    catch (const exception& e) { // stoi and friends on a malformed number
+        return out.str() + "error Malformed request: " + e.what() + "\n";
+    }
+    return out.str();
+}
+
+
+/*
+    Serves requests read line by line from stdin, writing the responses
+    to stdout, until quit or end of input.
+*/
+void serve_stdio(uint64_t max_insts) {
+    map<string, ServedProgram> programs;
+    string line;
+    bool quit = false;
+    while (!quit && getline(cin, line)) {
+        cout << serve_request(programs, line, max_insts, quit) << flush;
+    }
+}
+
+
+/*
+    Serves requests on a Unix domain socket, one client at a time. Programs
+    stay loaded between clients; a client ends its session with quit.
+
+    @return false if the socket could not be set up
+*/
+bool serve_socket(const string& path, uint64_t max_insts) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(addr.sun_path)) {
+        cerr << "Can't create socket " << path << endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 8) < 0) {
+        cerr << "Can't listen on socket " << path << endl;
+        close(listener);
+        return false;
+    }
+
+    map<string, ServedProgram> programs;
+    int client;
+    while ((client = accept(listener, nullptr, nullptr)) >= 0) {
+        string pending;
+        char buf[4096];
+        bool quit = false;
+        ssize_t got;
+        while (!quit && (got = read(client, buf, sizeof(buf))) > 0) {
+            pending.append(buf, got);
+            size_t newline;
+            while (!quit && (newline = pending.find('\n')) != string::npos) {
+                string response = serve_request(programs, pending.substr(0, newline), max_insts, quit);
+                pending.erase(0, newline + 1);
+                for (size_t sent = 0; sent < response.size();) {
+                    // not write(): a client that hung up must not kill the server with SIGPIPE,
+                    // it only gets dropped (EPIPE or ECONNRESET) while the next one is accepted
+                    ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+                    if (n < 0 && errno == EINTR)
+                        continue;
+                    if (n <= 0) {
+                        quit = true;
+                        break;
+                    }
+                    sent += n;
+                }
+            }
+        }
+        close(client);
+    }
+    close(listener);
+    return true;
+}
+
+
+/*
+    Calls work(i) for every i below n, spread over up to jobs threads.
+*/
+void parallel_for(size_t n, int jobs, const function<void(size_t)>& work) {
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (int job = 0; job < jobs && size_t(job) < n; job++) {
+        workers.emplace_back([&]() {
+            for (size_t i = next++; i < n; i = next++)
+                work(i);
+        });
+    }
+    for (thread& t : workers)
+        t.join();
+}
+
+
+/*
+    Lists the machine code files of a --batch. A directory stands for the
+    .bin files in it, in name order.
+
+    @param inputs The files and directories named on the command line
+
+    @param files Set to the files to run
+
+    @return false if a directory can't be read, with error set
+*/
+bool list_batch_files(const vector<string>& inputs, vector<string>& files, string& error) {
+    files.clear();
+    for (const string& input : inputs) {
+        struct stat info;
+        if (stat(input.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            files.push_back(input);
+            continue;
+        }
+        DIR* dir = opendir(input.c_str());
+        if (dir == nullptr) {
+            error = "Can't read directory " + input;
+            return false;
+        }
+        vector<string> names;
+        while (struct dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+                names.push_back(name);
+        }
+        closedir(dir);
+        sort(names.begin(), names.end());
+        for (const string& name : names)
+            files.push_back(input + (input.back() == '/' ? "" : "/") + name);
+    }
+    return true;
+}
+
+
+/*
+    Quotes a string for JSON, escaping quotes, backslashes and control characters.
+*/
+string json_string(const string& text) {
+    ostringstream out;
+    out << '"';
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\')
+            out << '\\' << ch;
+        else if ((unsigned char)ch < 0x20)
+            out << "\\u" << hex << setw(4) << setfill('0') << int(ch) << dec << setfill(' ');
+        else
+            out << ch;
+    }
+    out << '"';
+    return out.str();
+}
+
+
+/*
+    Quotes a CSV field, doubling the quotes inside it.
+*/
+string csv_field(const string& text) {
+    string out = "\"";
+    for (char ch : text) {
+        if (ch == '"')
+            out += '"';
+        out += ch;
+    }
+    return out + "\"";
+}
+
+
+/*
+    Runs every program of a --batch under every cache configuration on
+    jobs threads, and prints the hits, misses and stores of each cache
+    level as one CSV table, or as JSON. As in --serve, each program runs
+    once and its accesses are replayed for every configuration.
+
+    @param files The machine code files
+
+    @param configs The --cache configurations
+
+    @param max_insts The most instructions to execute of each program
+
+    @param json Whether to print JSON instead of CSV
+
+    @return false if a program or configuration can't be loaded
+*/
+bool run_batch(const vector<string>& files, const vector<string>& configs, uint64_t max_insts, int jobs, bool json) {
+    for (const string& config : configs) {
+        vector<Cache> caches;
+        if (!parse_cache_config(config, caches, 1)) {
+            cerr << "Invalid cache config " << config << endl;
+            return false;
+        }
+    }
+
+    // parsing is cheap and std::regex is not safe to build on several threads at once, so only the runs are parallel
+    vector<Machine> machines(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        ifstream f(files[i]);
+        if (!f.is_open()) {
+            cerr << "Can't open file " << files[i] << endl;
+            return false;
+        }
+        string error;
+        if (!parse_machine_code(f, machines[i].memory, error)) {
+            cerr << files[i] << ": " << error << endl;
+            return false;
+        }
+    }
+    vector<ServedProgram> programs(files.size());
+    parallel_for(files.size(), jobs, [&](size_t i) {
+        programs[i].instructions = record_accesses(machines[i], max_insts, programs[i].accesses);
+    });
+
+    vector<string> rows(files.size() * configs.size());
+    parallel_for(rows.size(), jobs, [&](size_t i) {
+        const string& file = files[i / configs.size()];
+        const string& config = configs[i % configs.size()];
+        const ServedProgram& program = programs[i / configs.size()];
+        vector<Cache> caches;
+        parse_cache_config(config, caches, 1);
+        for (const TraceRecord& r : program.accesses)
+            simulate_access(caches, r.is_store, r.pc, r.addr, false);
+        ostringstream out;
+        if (json) {
+            out << "  {\"program\": " << json_string(file) << ", \"cache\": " << json_string(config) << ", \"instructions\": " <<
+                program.instructions << ", \"caches\": [";
+            for (size_t level = 0; level < caches.size(); level++) {
+                const Cache& c = caches[level];
+                out << (level ? ", " : "") << "{\"name\": \"" << c.name << "\", \"hits\": " << c.hits <<
+                    ", \"misses\": " << c.misses << ", \"stores\": " << c.stores << "}";
+            }
+            out << "]}";
+        }
+        else {
+            for (const Cache& c : caches)
+                out << csv_field(file) << "," << csv_field(config) << "," << program.instructions << "," << c.name << "," <<
+                    c.hits << "," << c.misses << "," << c.stores << endl;
+        }
+        rows[i] = out.str();
+    });
+
+    if (json) {
+        cout << "[" << endl;
+        for (size_t i = 0; i < rows.size(); i++)
+            cout << rows[i] << (i + 1 < rows.size() ? "," : "") << endl;
+        cout << "]" << endl;
+    }
+    else {
+        cout << "program,cache,instructions,level,hits,misses,stores" << endl;
+        for (const string& row : rows)
+            cout << row;
+    }
+    return true;
+}
+
+
+/*
+    Prints how the lw misses of each cache split into compulsory,
+    capacity and conflict misses.
+*/
+void print_miss_classes(const Simulation& sim) {
+    for (const Cache& c : sim.caches) {
+        cout << "Cache " << c.name << " misses " << c.misses << ": compulsory " << c.classes.compulsory <<
+            ", capacity " << c.classes.capacity_misses << ", conflict " << c.classes.conflict << endl;
+    }
+    if (sim.icache.numlines > 0) {
+        const Cache& c = sim.icache;
+        cout << "Cache " << c.name << " misses " << c.misses << ": compulsory " << c.classes.compulsory <<
+            ", capacity " << c.classes.capacity_misses << ", conflict " << c.classes.conflict << endl;
+    }
+}
+
+
+/*
+    Prints, for every partition of a cache, how many of the cache's ways
+    it holds and how its accesses hit, and how many ways are held by
+    accesses that belong to no partition.
+*/
+void print_partitions(const Cache& c) {
+    size_t total = size_t(c.numlines) * c.assoc;
+    vector<size_t> occupancy(c.partitions.size() + 1, 0); // the last counts unpartitioned ways
+    for (size_t slot = 0; slot < c.slot_line.size(); slot++) {
+        const int* ways = &c.arena[slot * (2 * c.assoc + 1)];
+        for (int way = 0; way < c.assoc; way++) {
+            if (ways[way] == -1)
+                continue;
+            int owner = c.way_owner[slot * c.assoc + way];
+            occupancy[owner < 0 ? c.partitions.size() : owner]++;
+        }
+    }
+    cout << fixed;
+    for (size_t i = 0; i <= c.partitions.size(); i++) {
+        cout << "Partition " << c.name << " ";
+        if (i < c.partitions.size()) {
+            const Partition& part = c.partitions[i];
+            cout << i << " ways 0x" << hex << part.mask << dec << " " << (part.by_pc ? "pc" : "addr") << " " <<
+                part.lo << "-" << part.hi;
+        }
+        else {
+            cout << "unpartitioned";
+        }
+        cout << ": occupancy " << occupancy[i] << " of " << total << " ways (" << setprecision(1) <<
+            100.0 * occupancy[i] / total << "%)";
+        if (i < c.partitions.size()) {
+            const Partition& part = c.partitions[i];
+            cout << ", hits " << part.hits << ", misses " << part.misses << ", hit rate ";
+            if (part.hits + part.misses > 0)
+                cout << setprecision(4) << double(part.hits) / (part.hits + part.misses);
+            else
+                cout << "n/a";
+            cout << ", stores " << part.stores;
+        }
+        cout << endl;
+    }
+    cout << defaultfloat;
+}
+
+
+/*
+    Prints the sector misses of a sectored cache and the words it moved
+    to and from the next level.
+*/
+void print_sector_traffic(const Cache& c) {
+    cout << "Cache " << c.name << " sectors of " << c.sector_size << " words: sector misses " << c.sector_misses <<
+        ", fill traffic " << c.fill_words << " words, writeback traffic " << c.writeback_words << " words" << endl;
+}
+
+
+/*
+    Prints how many instruction fetches hit and missed the instruction
+    cache, and the data L2 when it is unified.
+*/
+void print_fetch_summary(const Simulation& sim) {
+    const Cache& ic = sim.icache;
+    cout << "Cache " << ic.name << " fetches " << ic.hits + ic.misses << ": hits " << ic.hits <<
+        ", misses " << ic.misses << endl;
+    if (sim.unified) {
+        const Cache& l2 = sim.caches[1];
+        cout << "Cache " << l2.name << " fetches " << l2.fetch_hits + l2.fetch_misses << ": hits " << l2.fetch_hits <<
+            ", misses " << l2.fetch_misses << endl;
+    }
+}
+
+
+/*
+    Prints the hits and misses of every TLB, what the page walks read and
+    cost, and the same for every pc that accessed memory.
+*/
+void print_tlb_summary(const Tlb& tlb) {
+    for (const Cache& c : tlb.levels) {
+        cout << "TLB " << c.name << " " << c.size / c.blocksize << " entries, pages of " << c.blocksize <<
+            " words: accesses " << c.hits + c.misses << ", hits " << c.hits << ", misses " << c.misses << endl;
+    }
+    cout << fixed << setprecision(3);
+    cout << "TLB walks " << tlb.walks << ": reads " << tlb.walk_reads << " (L1 " << tlb.walk_levels[0] << ", L2 " <<
+        tlb.walk_levels[1] << ", memory " << tlb.walk_levels[2] << "), cycles " << tlb.walk_cycles <<
+        ", average " << (tlb.walks ? double(tlb.walk_cycles) / tlb.walks : 0.0) << endl;
+    for (size_t pc = 0; pc < tlb.pc_accesses.size(); pc++) {
+        if (tlb.pc_accesses[pc] == 0)
+            continue;
+        cout << "TLB pc " << pc << " " << tlb.pc_accesses[pc] << " accesses: DTLB1 misses " << tlb.pc_misses[pc] <<
+            ", walks " << tlb.pc_walks[pc] << ", translation cycles " << tlb.pc_cycles[pc] << endl;
+    }
+    cout << defaultfloat;
+}
+
+
+/*
+    Prints how many branches of each kind were mispredicted, the cycles
+    the mispredicts are estimated to cost, and the same for every pc that
+    holds a branch.
+*/
+void print_branch_summary(const BranchPredictor& bp) {
+    cout << "Branch predictor " << PREDICTOR_NAMES[bp.kind] << ", " << (1 << bp.bits) << " counters, BTB " <<
+        bp.btb_pc.size() << " entries, RAS " << bp.ras_depth << " entries" << endl;
+    uint64_t executed = 0;
+    uint64_t mispredicts = 0;
+    for (int kind = BRANCH_JEQ; kind <= BRANCH_JR; kind++) {
+        cout << "Branches " << BRANCH_KIND_NAMES[kind] << " " << bp.kind_executed[kind] << ": mispredicted " <<
+            bp.kind_mispredicts[kind] << endl;
+        executed += bp.kind_executed[kind];
+        mispredicts += bp.kind_mispredicts[kind];
+    }
+    cout << "Branches " << executed << ": mispredicted " << mispredicts << ", estimated penalty " <<
+        mispredicts * bp.penalty << " cycles at " << bp.penalty << " cycles each" << endl;
+    for (size_t pc = 0; pc < MEM_SIZE; pc++) {
+        if (bp.pc_executed[pc] == 0)
+            continue;
+        cout << "Branch pc " << pc << " " << BRANCH_KIND_NAMES[bp.pc_kind[pc]] << " " << bp.pc_executed[pc] <<
+            ": mispredicted " << bp.pc_mispredicts[pc] << ", penalty " << bp.pc_mispredicts[pc] * bp.penalty <<
+            " cycles" << endl;
+    }
+}
+
+
+/*
+    Prints the cycles and CPI of the --pipeline timing, where the stall
+    cycles went, and the cycles and CPI of every pc that was executed.
+*/
+void print_pipeline_summary(const Pipeline& p) {
+    cout << fixed << setprecision(3);
+    cout << "Pipeline " << p.instructions << " instructions, " << p.cycles << " cycles, CPI " <<
+        (p.instructions ? double(p.cycles) / p.instructions : 0.0) << endl;
+    cout << "Pipeline stalls: load-use " << p.load_use << ", fetch " << p.fetch_stall << ", data " << p.data_stall <<
+        ", branch " << p.branch_stall;
+    if (p.translates)
+        cout << ", translation " << p.translate_stall;
+    cout << " cycles" << endl;
+    if (p.mshrs[0] > 0) {
+        cout << "Pipeline MSHRs L1 " << p.mshrs[0] << ", L2 " << p.mshrs[1] << ": merged misses " << p.merged <<
+            ", full MSHR stalls " << p.mshr_stall << " cycles, memory-level parallelism " <<
+            (p.busy_cycles ? double(p.miss_cycles) / p.busy_cycles : 0.0) << endl;
+    }
+    if (p.dram != nullptr) {
+        const Dram& d = *p.dram;
+        cout << "DRAM " << d.channels << " channels, " << d.banks << " banks, rows of " << d.row_size << " words, " <<
+            (d.open_row ? "open" : "closed") << " row: accesses " << d.accesses << ", row hits " << d.row_hits <<
+            " (" << (d.accesses ? 100.0 * d.row_hits / d.accesses : 0.0) << "%), empty " << d.row_empty <<
+            ", conflicts " << d.row_conflicts << ", average latency " <<
+            (d.accesses ? double(d.total_latency) / d.accesses : 0.0) << " cycles, max " << d.max_latency << endl;
+    }
+    for (size_t pc = 0; pc < p.pc_cycles.size(); pc++) {
+        if (p.pc_instructions[pc] == 0)
+            continue;
+        cout << "Pipeline pc " << pc << " " << p.pc_instructions[pc] << " instructions, " << p.pc_cycles[pc] <<
+            " cycles, CPI " << double(p.pc_cycles[pc]) / p.pc_instructions[pc] << endl;
+    }
+    cout << defaultfloat;
+}
+
+
+/*
+    Returns the peak resident memory of the simulator in kilobytes.
+*/
+long peak_memory_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+/*
+    Prints the --stats counters and timers to stderr.
+*/
+void print_stats(const Simulation& sim) {
+    uint64_t execute_ns = stats.run_ns - stats.lookup_ns - stats.output_ns;
+    cerr << "Simulator stats:" << endl;
+    cerr << "  instructions   " << stats.instructions << endl;
+    for (const Cache& c : sim.caches) {
+        cerr << "  " << c.name << " accesses    " << c.hits + c.misses + c.stores << " (" << c.hits << " hits, " <<
+            c.misses << " misses, " << c.stores << " stores)" << endl;
+        if (c.fetch_hits + c.fetch_misses > 0)
+            cerr << "  " << c.name << " fetches     " << c.fetch_hits + c.fetch_misses << " (" << c.fetch_hits <<
+                " hits, " << c.fetch_misses << " misses)" << endl;
+    }
+    if (sim.icache.numlines > 0) {
+        const Cache& c = sim.icache;
+        cerr << "  " << c.name << " fetches     " << c.hits + c.misses << " (" << c.hits << " hits, " <<
+            c.misses << " misses)" << endl;
+    }
+    cerr << fixed << setprecision(6);
+    cerr << "  load time      " << stats.load_ns / 1e9 << " s" << endl;
+    cerr << "  execute time   " << execute_ns / 1e9 << " s" << endl;
+    cerr << "  lookup time    " << stats.lookup_ns / 1e9 << " s" << endl;
+    cerr << "  output time    " << stats.output_ns / 1e9 << " s" << endl;
+    cerr << "  total time     " << stats.total_ns / 1e9 << " s" << endl;
+    cerr << defaultfloat;
+    cerr << "  peak memory    " << peak_memory_kb() << " KB" << endl;
+}
+
+
+/*
+    Writes the --stats counters and timers to a file as JSON.
+*/
+void write_stats_json(const string& filename, const Simulation& sim) {
+    ofstream f(filename);
+    if (!f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        exit(1);
+    }
+    uint64_t execute_ns = stats.run_ns - stats.lookup_ns - stats.output_ns;
+    f << "{" << endl;
+    f << "  \"instructions\": " << stats.instructions << "," << endl;
+    f << "  \"caches\": [";
+    for (size_t level = 0; level < sim.caches.size(); level++) {
+        const Cache& c = sim.caches[level];
+        f << (level ? ", " : "") << "{\"name\": \"" << c.name << "\", \"hits\": " << c.hits <<
+            ", \"misses\": " << c.misses << ", \"stores\": " << c.stores;
+        if (c.fetch_hits + c.fetch_misses > 0)
+            f << ", \"fetch_hits\": " << c.fetch_hits << ", \"fetch_misses\": " << c.fetch_misses;
+        f << "}";
+    }
+    f << "]," << endl;
+    if (sim.icache.numlines > 0) {
+        f << "  \"icache\": {\"name\": \"" << sim.icache.name << "\", \"hits\": " << sim.icache.hits <<
+            ", \"misses\": " << sim.icache.misses << "}," << endl;
+    }
+    f << "  \"time_ns\": {\"load\": " << stats.load_ns << ", \"execute\": " << execute_ns <<
+        ", \"lookup\": " << stats.lookup_ns << ", \"output\": " << stats.output_ns <<
+        ", \"total\": " << stats.total_ns << "}," << endl;
+    f << "  \"peak_memory_kb\": " << peak_memory_kb() << endl;
+    f << "}" << endl;
+}
+
+
+/**
+    Main function
+    Takes command-line args as documented below
+*/
+int main(int argc, char* argv[]) {
+    /*
+        Parse the command-line arguments
+    */
+    char* filename = nullptr;
+    bool do_help = false;
+    bool arg_error = false;
+    string cache_config;
+    uint64_t ff_count = 0;
+    uint64_t max_insts = UINT64_MAX;
+    string checkpoint_save;
+    string checkpoint_load;
+    vector<uint64_t> sample_parts;
+    int set_sample_ratio = 1;
+    string trace_save;
+    string trace_replay;
+    string stats_json;
+    bool serve = false;
+    string serve_path;
+    int search_budget = 0;
+    string latency_config = "1,10,100";
+    bool classify = false;
+    string shards_config;
+    string icache_config;
+    bool unified = false;
+    string branch_config;
+    int branch_penalty = 2;
+    vector<string> partition_configs;
+    vector<string> sector_configs;
+    bool pipeline = false;
+    string mshr_config;
+    string dram_config;
+    string tlb_config;
+    string event_log_file;
+    bool batch = false;
+    string batch_format = "csv";
+    int jobs = max(1u, thread::hardware_concurrency());
+    vector<string> cache_configs;   // every --cache, for --batch
+    vector<string> inputs;          // every positional argument, for --batch
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg.rfind("-", 0) == 0) {
+            if (arg == "-h" || arg == "--help")
+                do_help = true;
+            else if (arg == "--cache") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else {
+                    cache_config = argv[i];
+                    cache_configs.push_back(cache_config);
+                }
+            }
+            else if (arg == "--fast-forward" || arg == "--max-insts") {
+                i++;
+                if (i >= argc || !parse_count_arg(argv[i], arg == "--fast-forward" ? ff_count : max_insts))
+                    arg_error = true;
+            }
+            else if (arg == "--stats")
+                stats.enabled = true;
+            else if (arg == "--serve")
+                serve = true;
+            else if (arg == "--3c")
+                classify = true;
+            else if (arg == "--unified-l2")
+                unified = true;
+            else if (arg == "--pipeline")
+                pipeline = true;
+            else if (arg == "--batch")
+                batch = true;
+            else if (arg == "--batch-format") {
+                i++;
+                if (i >= argc || (string(argv[i]) != "csv" && string(argv[i]) != "json"))
+                    arg_error = true;
+                else
+                    batch_format = argv[i];
+            }
+            else if (arg == "--jobs") {
+                i++;
+                if (i >= argc || !parse_int_arg(argv[i], 1, jobs))
+                    arg_error = true;
+            }
+            else if (arg == "--event-log") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    event_log_file = argv[i];
+            }
+            else if (arg == "--tlb") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    tlb_config = argv[i];
+            }
+            else if (arg == "--dram") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    dram_config = argv[i];
+            }
+            else if (arg == "--mshr") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    mshr_config = argv[i];
+            }
+            else if (arg == "--partition" || arg == "--sector") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else if (arg == "--partition")
+                    partition_configs.push_back(argv[i]);
+                else
+                    sector_configs.push_back(argv[i]);
+            }
+            else if (arg == "--branch") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    branch_config = argv[i];
+            }
+            else if (arg == "--branch-penalty") {
+                i++;
+                if (i >= argc || !parse_int_arg(argv[i], 0, branch_penalty))
+                    arg_error = true;
+            }
+            else if (arg == "--icache") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    icache_config = argv[i];
+            }
+            else if (arg == "--search") {
+                i++;
+                if (i >= argc || !parse_int_arg(argv[i], 1, search_budget) || search_budget > MAX_CACHE_SIZE)
+                    arg_error = true;
+            }
+            else if (arg == "--shards") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    shards_config = argv[i];
+            }
+            else if (arg == "--latency") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else
+                    latency_config = argv[i];
+            }
+            else if (arg == "--serve-socket") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else {
+                    serve = true;
+                    serve_path = argv[i];
+                }
+            }
+            else if (arg == "--stats-json") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else {
+                    stats.enabled = true;
+                    stats_json = argv[i];
+                }
+            }
+            else if (arg == "--set-sample") {
+                i++;
+                if (i >= argc || !parse_int_arg(argv[i], 1, set_sample_ratio))
+                    arg_error = true;
+            }
+            else if (arg == "--checkpoint-save" || arg == "--checkpoint-load" || arg == "--sample" ||
+                arg == "--trace-save" || arg == "--trace") {
+                i++;
+                if (i >= argc)
+                    arg_error = true;
+                else if (arg == "--trace-save")
+                    trace_save = argv[i];
+                else if (arg == "--trace")
+                    trace_replay = argv[i];
+                else if (arg == "--checkpoint-save")
+                    checkpoint_save = argv[i];
+                else if (arg == "--checkpoint-load")
+                    checkpoint_load = argv[i];
+                else {
+                    string sample_config = argv[i];
+                    sample_parts.clear();
+                    size_t pos;
+                    size_t lastpos = 0;
+                    while ((pos = sample_config.find(",", lastpos)) != string::npos) {
+                        sample_parts.push_back(0);
+                        if (!parse_count_arg(sample_config.substr(lastpos, pos - lastpos), sample_parts.back()))
+                            arg_error = true;
+                        lastpos = pos + 1;
+                    }
+                    sample_parts.push_back(0);
+                    if (!parse_count_arg(sample_config.substr(lastpos), sample_parts.back()))
+                        arg_error = true;
+                }
+            }
+            else
+                arg_error = true;
+        }
+        else {
+            if (filename == nullptr)
+                filename = argv[i];
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (inputs.size() > 1 && !batch)
+        arg_error = true;
+    if (batch && (inputs.empty() || cache_configs.empty()))
+        arg_error = true;
+    /* Display error message if appropriate */
+    if (arg_error || do_help || (filename == nullptr && checkpoint_load.empty() && trace_replay.empty() && !serve) ||
+        ((search_budget > 0 || !shards_config.empty()) && filename == nullptr && trace_replay.empty())) {
+        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] [--fast-forward N] [--max-insts N]" << endl;
+        cerr << "       [--sample PERIOD,DETAIL[,WARMUP]] [--set-sample RATIO]" << endl;
+        cerr << "       [--checkpoint-save FILE] [--checkpoint-load FILE] [--trace-save FILE]" << endl;
+        cerr << "       [--trace FILE] [--stats] [--stats-json FILE] [--serve] [--serve-socket PATH]" << endl;
+        cerr << "       [--search BUDGET] [--latency L1,L2,MEM] [--3c] [--icache ICACHE]" << endl;
+        cerr << "       [--unified-l2] [--branch PREDICTOR] [--branch-penalty CYCLES] [--pipeline]" << endl;
+        cerr << "       [--batch] [--batch-format csv|json] [--jobs N] [--partition PARTITION]" << endl;
+        cerr << "       [--sector LEVEL,SECTOR_SIZE] [--mshr L1[,L2]] [--dram DRAM]" << endl;
+        cerr << "       [--tlb TLB] [--event-log FILE]" << endl;
+        cerr << "       [--shards rate,R[,BLOCKSIZE] | --shards size,N[,BLOCKSIZE]] filename" << endl << endl;
+        cerr << "Simulate E20 cache" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix." << endl;
+        cerr << "              May be omitted when resuming from a checkpoint, replaying a trace" << endl;
+        cerr << "              or serving. --batch takes any number of files and directories" << endl << endl;
+        cerr << "optional arguments:" << endl;
+        cerr << "  -h, --help  show this help message and exit" << endl;
+        cerr << "  --cache CACHE  Cache configuration: size,associativity,blocksize (for one" << endl;
+        cerr << "                 cache) or" << endl;
+        cerr << "                 size,associativity,blocksize,size,associativity,blocksize" << endl;
+        cerr << "                 (for two caches)" << endl;
+        cerr << "  --fast-forward N  Execute the first N instructions without simulating the" << endl;
+        cerr << "                 caches" << endl;
+        cerr << "  --max-insts N  Stop after N instructions have been executed" << endl;
+        cerr << "  --sample PERIOD,DETAIL[,WARMUP]  Every PERIOD instructions, warm the caches" << endl;
+        cerr << "                 for WARMUP instructions and measure the next DETAIL; skip the" << endl;
+        cerr << "                 rest. Prints estimated miss rates instead of the access log" << endl;
+        cerr << "  --set-sample RATIO  Simulate only about 1/RATIO of the lines of the last" << endl;
+        cerr << "                 cache level and print scaled estimates of its miss rate." << endl;
+        cerr << "                 Accesses to the other lines are not simulated, so it can't be" << endl;
+        cerr << "                 used with the timing of --pipeline or --tlb" << endl;
+        cerr << "  --checkpoint-save FILE  Save the pc, registers, memory and cache state to" << endl;
+        cerr << "                 FILE when the simulation stops" << endl;
+        cerr << "  --checkpoint-load FILE  Resume from a checkpoint saved with the same --cache" << endl;
+        cerr << "  --trace-save FILE  Record every simulated lw and sw to a compressed trace" << endl;
+        cerr << "  --trace FILE   Simulate the caches on a trace saved by --trace-save instead" << endl;
+        cerr << "                 of running a program" << endl;
+        cerr << "  --stats        Print simulator counters, timings and peak memory to stderr." << endl;
+        cerr << "                 Not available with --serve, --batch, --search or --shards" << endl;
+        cerr << "  --stats-json FILE  Write the --stats counters to FILE as JSON instead" << endl;
+        cerr << "  --serve        Keep programs loaded and answer load/run requests on" << endl;
+        cerr << "                 stdin, see serve_request() for the protocol" << endl;
+        cerr << "  --serve-socket PATH  Like --serve, on a Unix domain socket at PATH" << endl;
+        cerr << "  --search BUDGET  Search one and two level cache configurations of total" << endl;
+        cerr << "                 size at most BUDGET, up to " << MAX_CACHE_SIZE << ", and print the Pareto front" << endl;
+        cerr << "                 of size against average lw latency" << endl;
+        cerr << "  --latency L1,L2,MEM  Cycles of an L1 hit, L2 hit and memory access for" << endl;
+        cerr << "                 --search and --pipeline (default 1,10,100)" << endl;
+        cerr << "  --3c           Classify every lw miss as compulsory, capacity or conflict" << endl;
+        cerr << "                 in the log, and print the totals at the end" << endl;
+        cerr << "  --shards rate,R[,BLOCKSIZE]  Estimate the reuse distance histogram and miss" << endl;
+        cerr << "                 ratio curve from a spatially hashed sample of about R of the" << endl;
+        cerr << "                 blocks, instead of simulating caches" << endl;
+        cerr << "  --shards size,N[,BLOCKSIZE]  The same, tracking at most N blocks" << endl;
+        cerr << "  --icache ICACHE  Also simulate every instruction fetch against an instruction" << endl;
+        cerr << "                 cache I1 of size,associativity,blocksize" << endl;
+        cerr << "  --unified-l2   Send I1 misses to the L2 of a two cache --cache" << endl;
+        cerr << "  --branch PREDICTOR  Predict jeq, j, jal and jr and print the mispredicts;" << endl;
+        cerr << "                 PREDICTOR is static, bimodal, gshare or tage, optionally" << endl;
+        cerr << "                 followed by ,BITS[,BTB_ENTRIES[,RAS_DEPTH]] (default 12,64,8)" << endl;
+        cerr << "  --branch-penalty CYCLES  Cycles lost on a mispredict (default 2)" << endl;
+        cerr << "  --pipeline     Time the program on a 5-stage in-order pipeline and print" << endl;
+        cerr << "                 its cycles and CPI, overall and per pc" << endl;
+        cerr << "  --batch        Run every filename, or every .bin file of a directory given" << endl;
+        cerr << "                 as filename, under every --cache given, and print a table of" << endl;
+        cerr << "                 the hits, misses and stores of each level" << endl;
+        cerr << "  --batch-format csv|json  The format of the --batch table (default csv)" << endl;
+        cerr << "  --jobs N       Threads to run --batch on (default one per core)" << endl;
+        cerr << "  --partition LEVEL,MASK,pc|addr,LO,HI  Let the accesses of the pcs or the" << endl;
+        cerr << "                 data addresses LO to HI fill only the ways of cache LEVEL in" << endl;
+        cerr << "                 MASK, such as L2,0x3,pc,0,99. May be given more than once" << endl;
+        cerr << "  --sector LEVEL,SECTOR_SIZE  Keep valid and dirty bits per SECTOR_SIZE words of" << endl;
+        cerr << "                 each block of cache LEVEL, fetch only the missed sector and" << endl;
+        cerr << "                 print the fill and writeback traffic. A SECTOR_SIZE equal to" << endl;
+        cerr << "                 the blocksize gives the traffic of the unsectored cache" << endl;
+        cerr << "  --mshr L1[,L2]  Make the data caches non-blocking for --pipeline, with this" << endl;
+        cerr << "                 many MSHRs in L1 and L2, and print the memory-level parallelism" << endl;
+        cerr << "  --dram CHANNELS,BANKS,ROW_SIZE,open|closed[,tRCD,tCAS,tRP,tBURST]  Read memory" << endl;
+        cerr << "                 for --pipeline from a DRAM with row buffers of ROW_SIZE words" << endl;
+        cerr << "                 and FR-FCFS scheduling instead of the memory latency, and print" << endl;
+        cerr << "                 its row hit rate and latency (default timings 14,14,14,4)" << endl;
+        cerr << "  --tlb L1_ENTRIES,L1_ASSOC,PAGE_SIZE[,L2_ENTRIES,L2_ASSOC]  Translate every lw" << endl;
+        cerr << "                 and sw address through one or two data TLBs, walking a page" << endl;
+        cerr << "                 table through the data caches on a miss, and print the TLB" << endl;
+        cerr << "                 misses and walk cycles, overall and per pc. Walks are timed" << endl;
+        cerr << "                 with --latency" << endl;
+        cerr << "  --event-log FILE  Write the log to FILE as binary columns instead of text." << endl;
+        cerr << "                 simlog FILE prints it as text" << endl;
+        return 1;
+    }
+    if (!STATS_COMPILED && stats.enabled) {
+        cerr << "This simcache was built with SIMCACHE_NO_STATS, --stats is not available" << endl;
+        return 1;
+    }
+    // the counters and timers are those of one simulation, which these modes don't run
+    if (stats.enabled && (serve || batch || search_budget > 0 || !shards_config.empty())) {
+        cerr << "--stats and --stats-json report one simulation, they can't be used with --serve, --batch, --search" <<
+            " or --shards" << endl;
+        return 1;
+    }
+    stats.total_ns = stats_clock();
+
+    if (serve) {
+        if (serve_path.empty())
+            serve_stdio(max_insts);
+        else if (!serve_socket(serve_path, max_insts))
+            return 1;
+        return 0;
+    }
+
+    if (batch) {
+        vector<string> files;
+        string error;
+        if (!list_batch_files(inputs, files, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        if (!run_batch(files, cache_configs, max_insts, jobs, batch_format == "json"))
+            return 1;
+        return 0;
+    }
+
+    if (search_budget > 0) {
+        vector<double> latency;
+        if (!parse_latency_config(latency_config, latency)) {
+            cerr << "Invalid latency config" << endl;
+            return 1;
+        }
+        vector<TraceRecord> accesses;
+        string error;
+        if (!trace_replay.empty()) {
+            if (!read_trace(trace_replay, accesses, error)) {
+                cerr << error << endl;
+                return 1;
+            }
+        }
+        else {
+            ifstream f(filename);
+            if (!f.is_open()) {
+                cerr << "Can't open file " << filename << endl;
+                return 1;
+            }
+            Machine* machine = new Machine();
+            load_machine_code(f, machine->memory);
+            record_accesses(*machine, max_insts, accesses);
+            delete machine;
+        }
+        run_search(accesses, search_budget, latency);
+        return 0;
+    }
+
+    if (!shards_config.empty()) {
+        Shards shards;
+        if (!parse_shards_config(shards_config, shards)) {
+            cerr << "Invalid shards config" << endl;
+            return 1;
+        }
+        shards_compact(shards);
+
+        if (!trace_replay.empty()) {
+            scan_trace(trace_replay, [&](const TraceRecord& r) { shards_access(shards, r.addr); });
+        }
+        else {
+            ifstream f(filename);
+            if (!f.is_open()) {
+                cerr << "Can't open file " << filename << endl;
+                return 1;
+            }
+            Machine* machine = new Machine();
+            load_machine_code(f, machine->memory);
+            scan_accesses(*machine, max_insts, [&](const TraceRecord& r) { shards_access(shards, r.addr); });
+            delete machine;
+        }
+        print_shards(shards);
+        return 0;
+    }
+
+    Simulation sim;
+    vector<Cache>& caches = sim.caches;
+
+    if (cache_config.size() > 0) {
+        if (!parse_cache_config(cache_config, caches, set_sample_ratio)) {
+            cerr << "Invalid cache config" << endl;
+            return 1;
+        }
+        for (Cache& c : caches) {
+            print_cache_config(c.name, c.size, c.assoc, c.blocksize, c.numlines);
+            c.classes.enabled = classify;
+            // with --set-sample the shadow only sees the blocks of the sampled lines, so it only holds as many
+            c.classes.capacity = size_t(c.sampled_lines) * c.assoc;
+        }
+    }
+
+    if (icache_config.size() > 0) {
+        vector<Cache> parsed;
+        if (!parse_cache_config(icache_config, parsed, 1) || parsed.size() != 1) {
+            cerr << "Invalid icache config" << endl;
+            return 1;
+        }
+        if (!trace_replay.empty()) {
+            cerr << "Traces hold only lw and sw, --icache can't be used with --trace" << endl;
+            return 1;
+        }
+        sim.icache = parsed[0];
+        sim.icache.name = "I1";
+        sim.icache.classes.enabled = classify;
+        sim.icache.classes.capacity = size_t(sim.icache.numlines) * sim.icache.assoc;
+        print_cache_config(sim.icache.name, sim.icache.size, sim.icache.assoc, sim.icache.blocksize, sim.icache.numlines);
+    }
+    for (const string& config : sector_configs) {
+        if (!parse_sector_config(config, sim)) {
+            cerr << "Invalid sector config " << config << endl;
+            return 1;
+        }
+    }
+
+    for (const string& config : partition_configs) {
+        if (!parse_partition_config(config, sim)) {
+            cerr << "Invalid partition config " << config << endl;
+            return 1;
+        }
+    }
+
+    if (unified) {
+        if (caches.size() != 2 || sim.icache.numlines == 0) {
+            cerr << "--unified-l2 needs --icache and two caches in --cache" << endl;
+            return 1;
+        }
+        sim.unified = true;
+    }
+
+    if (branch_config.size() > 0) {
+        if (!parse_branch_config(branch_config, sim.branches)) {
+            cerr << "Invalid branch config" << endl;
+            return 1;
+        }
+        if (!trace_replay.empty()) {
+            cerr << "Traces hold only lw and sw, --branch can't be used with --trace" << endl;
+            return 1;
+        }
+        sim.branches.penalty = branch_penalty;
+    }
+
+    if (pipeline) {
+        vector<double> latency;
+        if (!parse_latency_config(latency_config, latency)) {
+            cerr << "Invalid latency config" << endl;
+            return 1;
+        }
+        if (!trace_replay.empty()) {
+            cerr << "Traces hold only lw and sw, --pipeline can't be used with --trace" << endl;
+            return 1;
+        }
+        sim.pipeline.enabled = true;
+        for (int level = 0; level < 3; level++)
+            sim.pipeline.latency[level] = llround(latency[level]);
+        sim.pipeline.penalty = branch_penalty;
+    }
+
+    // the unsampled lines report no level an access was served from, so cycles counted over them would be made up
+    if (set_sample_ratio > 1 && (pipeline || tlb_config.size() > 0)) {
+        cerr << "--set-sample simulates only some lines, it can't be used with --pipeline or --tlb" << endl;
+        return 1;
+    }
+
+    if (tlb_config.size() > 0) {
+        vector<double> latency;
+        if (!parse_tlb_config(tlb_config, sim.tlb)) {
+            cerr << "Invalid tlb config" << endl;
+            return 1;
+        }
+        if (!parse_latency_config(latency_config, latency)) {
+            cerr << "Invalid latency config" << endl;
+            return 1;
+        }
+        if (!trace_replay.empty()) {
+            cerr << "Traces hold only lw and sw, --tlb can't be used with --trace" << endl;
+            return 1;
+        }
+        for (int level = 0; level < 3; level++)
+            sim.tlb.latency[level] = llround(latency[level]);
+        for (const Cache& c : sim.tlb.levels)
+            print_cache_config(c.name, c.size, c.assoc, c.blocksize, c.numlines);
+        sim.pipeline.translates = pipeline;
+    }
+
+    if (mshr_config.size() > 0) {
+        size_t comma = mshr_config.find(",");
+        int l1 = 0;
+        int l2 = 0;
+        if (!parse_int_arg(mshr_config.substr(0, comma), 1, l1) ||
+            !parse_int_arg(comma == string::npos ? mshr_config : mshr_config.substr(comma + 1), 1, l2)) {
+            cerr << "Invalid mshr config, usage: --mshr L1[,L2] with at least 1 MSHR per level" << endl;
+            return 1;
+        }
+        if (!pipeline || caches.empty()) {
+            cerr << "Invalid mshr config, --mshr needs --pipeline and --cache" << endl;
+            return 1;
+        }
+        for (size_t level = 0; level < caches.size(); level++) {
+            sim.pipeline.mshrs[level] = level == 0 ? l1 : l2;
+            sim.pipeline.blocksize[level] = caches[level].blocksize;
+        }
+    }
+
+    if (dram_config.size() > 0) {
+        if (!parse_dram_config(dram_config, sim.dram)) {
+            cerr << "Invalid dram config" << endl;
+            return 1;
+        }
+        if (!pipeline) {
+            cerr << "--dram needs --pipeline" << endl;
+            return 1;
+        }
+        // a read goes through the L2 lookup, if there is an L2, on its way to the controller
+        if (caches.size() == 2)
+            sim.dram.delay = sim.pipeline.latency[1] - sim.pipeline.latency[0];
+        sim.pipeline.dram = &sim.dram;
+    }
+
+    uint64_t sample_period = 0;
+    uint64_t sample_detail = 0;
+    uint64_t sample_warmup = 0;
+    if (sample_parts.size() > 0) {
+        const vector<uint64_t>& parts = sample_parts;
+        if (parts.size() < 2 || parts.size() > 3 || parts[1] == 0 ||
+            parts[1] > parts[0] || (parts.size() == 3 ? parts[2] : 0) > parts[0] - parts[1]) {
+            cerr << "Invalid sample config" << endl;
+            return 1;
+        }
+        sample_period = parts[0];
+        sample_detail = parts[1];
+        sample_warmup = parts.size() == 3 ? parts[2] : 0;
+    }
+
+    TraceWriter trace;
+    if (!trace_save.empty()) {
+        open_trace_writer(trace, trace_save);
+    }
+
+    EventLog events;
+    if (!event_log_file.empty()) {
+        vector<const Cache*> logged;
+        for (const Cache& c : caches)
+            logged.push_back(&c);
+        if (sim.icache.numlines > 0)
+            logged.push_back(&sim.icache);
+        for (const Cache& c : sim.tlb.levels)
+            logged.push_back(&c);
+        vector<string> names;
+        vector<int> configs;
+        for (const Cache* c : logged) {
+            names.push_back(c->name);
+            configs.insert(configs.end(), { c->size, c->assoc, c->blocksize, c->numlines });
+        }
+        open_event_log(events, event_log_file, names, configs,
+            vector<string>(begin(MISS_CLASS_NAMES), end(MISS_CLASS_NAMES)));
+        if (sim.pipeline.enabled)
+            events.clock = &sim.pipeline.cycles;
+        event_log = &events;
+    }
+
+    Machine* machine = new Machine();
+    uint64_t executed = 0;
+
+    if (!trace_replay.empty()) {
+        uint64_t t = stats_clock();
+        replay_trace(trace_replay, caches, true);
+        stats.run_ns += stats_clock() - t;
+    }
+    else {
+        uint64_t t = stats_clock();
+        if (!checkpoint_load.empty()) {
+            executed = load_checkpoint(checkpoint_load, *machine, sim);
+        }
+        else {
+            ifstream f(filename);
+            if (!f.is_open()) {
+                cerr << "Can't open file " << filename << endl;
+                return 1;
+            }
+            load_machine_code(f, machine->memory);
+        }
+        stats.load_ns += stats_clock() - t;
+
+        t = stats_clock();
+        if (executed < max_insts) {
+            executed += fast_forward(*machine, min(ff_count, max_insts - executed));
+        }
+        if (executed < max_insts) {
+            if (sample_period > 0)
+                executed += simulate_sampled(*machine, sim, sample_period, sample_detail, sample_warmup, max_insts - executed);
+            else
+                executed += simulate(*machine, sim, max_insts - executed, true, trace_save.empty() ? nullptr : &trace);
+        }
+        stats.run_ns += stats_clock() - t;
+
+        if (!trace_save.empty()) {
+            close_trace_writer(trace);
+        }
+
+        if (!checkpoint_save.empty()) {
+            save_checkpoint(checkpoint_save, *machine, sim, executed);
+        }
+    }
+
+    if (event_log != nullptr) {
+        close_event_log(events);
+        event_log = nullptr;
+    }
+
+    if (!caches.empty() && caches.back().sample_ratio > 1) {
+        print_set_sample_summary(caches.back());
+    }
+
+    if (sim.icache.numlines > 0) {
+        print_fetch_summary(sim);
+    }
+
+    if (sim.tlb.enabled) {
+        print_tlb_summary(sim.tlb);
+    }
+
+    for (const Cache& c : caches) {
+        if (c.sector_size > 0)
+            print_sector_traffic(c);
+    }
+    if (sim.icache.sector_size > 0) {
+        print_sector_traffic(sim.icache);
+    }
+
+    for (const Cache& c : caches) {
+        if (!c.partitions.empty())
+            print_partitions(c);
+    }
+    if (!sim.icache.partitions.empty()) {
+        print_partitions(sim.icache);
+    }
+
+    if (sim.branches.enabled) {
+        print_branch_summary(sim.branches);
+    }
+
+    if (sim.pipeline.enabled) {
+        if (sim.pipeline.dram != nullptr)
+            dram_drain(sim.dram);
+        print_pipeline_summary(sim.pipeline);
+    }
+
+    if (classify) {
+        print_miss_classes(sim);
+    }
+
+    if (STATS_COMPILED && stats.enabled) {
+        stats.instructions = executed;
+        stats.total_ns = stats_clock() - stats.total_ns;
+        if (stats_json.empty())
+            print_stats(sim);
+        else
+            write_stats_json(stats_json, sim);
+    }
 
+    delete machine;
     return 0;
 }
 //ra0Eequ6ucie6Jei0koh6phishohm9
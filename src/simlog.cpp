@@ -0,0 +1,177 @@
+/*
+simlog.cpp
+Prints a binary event log written by simcache --event-log as the text
+log simcache prints without it, see simlog.h for the format.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include "simlog.h"
+
+using namespace std;
+
+/*
+    Reads a little endian integer of the given number of bytes from data.
+*/
+uint64_t get_le(const char* data, int bytes) {
+    uint64_t v = 0;
+    for (int byte = 0; byte < bytes; byte++)
+        v |= uint64_t((unsigned char)data[byte]) << (8 * byte);
+    return v;
+}
+
+
+/*
+    Reads a little endian integer of the given number of bytes from a file.
+
+    @return false at the end of the file
+*/
+bool read_le(istream& f, int bytes, uint64_t& v) {
+    char data[8];
+    if (!f.read(data, bytes))
+        return false;
+    v = get_le(data, bytes);
+    return true;
+}
+
+
+/*
+    Reads a string of a u8 length and its characters.
+*/
+bool read_name(istream& f, string& name) {
+    uint64_t length;
+    if (!read_le(f, 1, length))
+        return false;
+    name.resize(length);
+    return length == 0 || bool(f.read(&name[0], length));
+}
+
+
+/*
+    Prints the text of every event of a log.
+
+    @param configs Whether to first print the config of every cache, as simcache does
+
+    @param cycles Whether to append the cycle of every event
+
+    @return false if the file is not a readable event log
+*/
+bool print_event_log(const string& filename, bool configs, bool cycles) {
+    ifstream f(filename, ios::binary);
+    if (!f.is_open()) {
+        cerr << "Can't open file " << filename << endl;
+        return false;
+    }
+    char magic[8];
+    uint64_t version, count;
+    if (!f.read(magic, 8) || string(magic, 8) != string(EVENT_LOG_MAGIC, 8) || !read_le(f, 4, version) ||
+        version != EVENT_LOG_VERSION || !read_le(f, 4, count)) {
+        cerr << filename << " is not an event log" << endl;
+        return false;
+    }
+    size_t header = 16;
+    vector<string> names(count);
+    for (string& name : names) {
+        uint64_t config[4];
+        bool ok = read_name(f, name);
+        for (int i = 0; i < 4 && ok; i++)
+            ok = read_le(f, 4, config[i]);
+        if (!ok) {
+            cerr << filename << " has a truncated header" << endl;
+            return false;
+        }
+        header += 1 + name.size() + 16;
+        if (configs)
+            cout << "Cache " << name << " has size " << config[0] << ", associativity " << config[1] <<
+                ", blocksize " << config[2] << ", lines " << config[3] << endl;
+    }
+    if (!read_le(f, 4, count)) {
+        cerr << filename << " has a truncated header" << endl;
+        return false;
+    }
+    header += 4;
+    vector<string> notes(count);
+    for (string& note : notes) {
+        if (!read_name(f, note)) {
+            cerr << filename << " has a truncated header" << endl;
+            return false;
+        }
+        header += 1 + note.size();
+    }
+    f.ignore((8 - header % 8) % 8);
+
+    vector<char> chunk;
+    uint64_t n;
+    while (read_le(f, 4, n)) {
+        chunk.resize(event_chunk_bytes(n) - 4);
+        if (n == 0 || n > EVENT_LOG_CHUNK || !f.read(chunk.data(), chunk.size())) {
+            cerr << filename << " has a truncated chunk" << endl;
+            return false;
+        }
+        const char* cycle = chunk.data() + 4; // after the zero that follows n
+        const char* line = cycle + 8 * n;
+        const char* addr = line + 4 * n;
+        const char* pc = addr + 4 * n;
+        const char* level = pc + 2 * n;
+        const char* status = level + n;
+        const char* note = status + n;
+        for (uint64_t i = 0; i < n; i++) {
+            size_t l = (unsigned char)level[i];
+            size_t s = (unsigned char)status[i];
+            size_t k = (unsigned char)note[i];
+            if (l >= names.size() || s >= EVENT_STATUSES || k >= notes.size()) {
+                cerr << filename << " has an invalid event" << endl;
+                return false;
+            }
+            cout << left << setw(8) << names[l] + " " + EVENT_STATUS_NAMES[s] << right <<
+                " pc:" << setw(5) << get_le(pc + 2 * i, 2) <<
+                "\taddr:" << setw(5) << int32_t(get_le(addr + 4 * i, 4)) <<
+                "\tline:" << setw(4) << int32_t(get_le(line + 4 * i, 4));
+            if (!notes[k].empty())
+                cout << "\t" << notes[k];
+            if (cycles)
+                cout << "\tcycle:" << get_le(cycle + 8 * i, 8);
+            cout << '\n';
+        }
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[]) {
+    string filename;
+    bool configs = true;
+    bool cycles = false;
+    bool do_help = false;
+    bool arg_error = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+            do_help = true;
+        else if (arg == "--cycles")
+            cycles = true;
+        else if (arg == "--no-configs")
+            configs = false;
+        else if (arg[0] == '-' || !filename.empty())
+            arg_error = true;
+        else
+            filename = arg;
+    }
+    if (arg_error || do_help || filename.empty()) {
+        cerr << "usage " << argv[0] << " [-h] [--cycles] [--no-configs] filename" << endl << endl;
+        cerr << "Print a simcache --event-log as the text log" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename       The event log to print" << endl << endl;
+        cerr << "optional arguments:" << endl;
+        cerr << "  -h, --help     show this help message and exit" << endl;
+        cerr << "  --cycles       Append the --pipeline cycle of every entry" << endl;
+        cerr << "  --no-configs   Print only the entries, not the cache configs" << endl;
+        return do_help && !arg_error ? 0 : 1;
+    }
+    return print_event_log(filename, configs, cycles) ? 0 : 1;
+}
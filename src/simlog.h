@@ -0,0 +1,59 @@
+/*
+simlog.h
+The binary event log that simcache --event-log writes in place of the
+text log, and that simlog turns back into text.
+
+Every integer is little endian. The file starts with a header:
+
+    8 bytes   EVENT_LOG_MAGIC
+    u32       EVENT_LOG_VERSION
+    u32       the number of caches, then for each, in the order simcache
+              prints their configs: a u8 name length, the name, and the
+              u32 size, associativity, blocksize and lines
+    u32       the number of notes, then for each a u8 length and the note.
+              Note 0 is the empty note
+    zeros up to a multiple of 8 bytes
+
+followed by chunks of at most EVENT_LOG_CHUNK events, each of them:
+
+    u32       n, the number of events in the chunk
+    u32       zero
+    u64[n]    cycle, the --pipeline cycle of the instruction, 0 without it
+    u32[n]    line, the line (set) accessed, as a two's complement int
+    u32[n]    addr, the same way
+    u16[n]    pc
+    u8[n]     level, the index of the cache in the header
+    u8[n]     status, an index into EVENT_STATUS_NAMES
+    u8[n]     note, an index into the notes of the header
+    zeros up to a multiple of 8 bytes
+
+so every column of a chunk is aligned and at an offset given by n alone,
+see event_chunk_bytes(), and can be mapped straight into memory.
+*/
+
+#ifndef SIMLOG_H
+#define SIMLOG_H
+
+#include <cstddef>
+#include <cstdint>
+
+char const static EVENT_LOG_MAGIC[] = "E20EVT1\n";
+uint32_t const static EVENT_LOG_VERSION = 1;
+
+// Events buffered before a chunk is written
+size_t const static EVENT_LOG_CHUNK = 1 << 16;
+
+// The statuses of the log, in the order of the status column
+const char* const EVENT_STATUS_NAMES[] = { "SW", "HIT", "MISS" };
+size_t const static EVENT_STATUSES = 3;
+
+/*
+    Returns the size of a chunk of n events, including its 8 byte count
+    and padding.
+*/
+inline size_t event_chunk_bytes(size_t n) {
+    size_t bytes = 8 + n * (8 + 4 + 4 + 2 + 1 + 1 + 1);
+    return (bytes + 7) / 8 * 8;
+}
+
+#endif